@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "soa.hpp"
+
+
+namespace useful
+{
+
+template <class T, std::size_t Width, class... MemberContainer>
+class aosoa;
+
+// Array of structs of arrays: elements are stored in blocks of Width, each
+// block holding an array of Width values per member. A kernel touching
+// several members of an element reads from one block instead of one stream
+// per member, while the values of a member within a block are still
+// contiguous for SIMD loads. Offers the push_back, operator[] and
+// element_proxy interface of soa; a member is only contiguous within a block,
+// see block_data.
+template <class T,
+          std::size_t Width,
+          class... MemberPtrTypes,
+          MemberPtrTypes... MemberPtrValues>
+class aosoa<T, Width, member_container<MemberPtrTypes, MemberPtrValues>...>
+{
+    static_assert(Width > 0, "aosoa requires a positive block width");
+
+public:
+    typedef T value_type;
+    typedef element_proxy<T,
+                          member_reference<MemberPtrTypes, MemberPtrValues>...>
+        proxy_value_type;
+    typedef const_element_proxy<
+        T,
+        member_reference<MemberPtrTypes, MemberPtrValues>...>
+        const_proxy_value_type;
+    typedef soa_iterator<aosoa, proxy_value_type> iterator;
+    typedef soa_iterator<const aosoa, const_proxy_value_type> const_iterator;
+
+    static constexpr std::size_t width = Width;
+
+    // blocks start on a cache line
+    struct alignas(64) block_type
+    {
+        std::tuple<std::array<soa_detail::member_type_t<MemberPtrTypes>,
+                              Width>...>
+            members;
+    };
+
+private:
+    typedef std::index_sequence_for<MemberPtrTypes...> indices;
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    static constexpr std::size_t
+    member_index()
+    {
+        return soa_detail::member_index<
+            member_reference<MemberPtrType, MemberPtrValue>,
+            member_reference<MemberPtrTypes, MemberPtrValues>...>();
+    }
+
+    // Assigns elems to element size_. elems may refer to elements of this,
+    // so a new block is filled before it is added, which can reallocate.
+    template <std::size_t... Is, class... Elems>
+    void
+    assign_back(std::index_sequence<Is...>, Elems&&... elems)
+    {
+        const std::size_t lane = size_ % Width;
+
+        if(lane == 0)
+        {
+            block_type b;
+            ((std::get<Is>(b.members)[0] = std::forward<Elems>(elems)), ...);
+            blocks_.push_back(std::move(b));
+        }
+        else
+        {
+            block_type& b = blocks_.back();
+            ((std::get<Is>(b.members)[lane] = std::forward<Elems>(elems)),
+             ...);
+        }
+
+        ++size_;
+    }
+
+    // Calls fn(n, pointers...) for the blocks [first, last) of self, full
+    // blocks passing n as std::integral_constant<std::size_t, Width>.
+    template <auto... Members, class Self, class Function>
+    static void
+    for_each_block(Self& self,
+                   std::size_t first,
+                   std::size_t last,
+                   Function& fn)
+    {
+        const std::size_t full = std::min(last, self.size_ / Width);
+
+        std::size_t b = first;
+        for(; b < full; ++b)
+        {
+            fn(std::integral_constant<std::size_t, Width>(),
+               self.template block_data<decltype(Members), Members>(b)...);
+        }
+
+        // at most the partially used last block
+        for(; b < last; ++b)
+        {
+            fn(self.size_ - b * Width,
+               self.template block_data<decltype(Members), Members>(b)...);
+        }
+    }
+
+    template <std::size_t... Is>
+    proxy_value_type
+    element(std::size_t n, std::index_sequence<Is...>)
+    {
+        block_type& b = blocks_[n / Width];
+        return proxy_value_type(std::get<Is>(b.members)[n % Width]...);
+    }
+
+    template <std::size_t... Is>
+    const_proxy_value_type
+    element(std::size_t n, std::index_sequence<Is...>) const
+    {
+        const block_type& b = blocks_[n / Width];
+        return const_proxy_value_type(std::get<Is>(b.members)[n % Width]...);
+    }
+
+public:
+    aosoa() : size_(0)
+    {
+    }
+
+    std::size_t
+    size() const
+    {
+        return size_;
+    }
+
+    bool
+    empty() const
+    {
+        return size_ == 0;
+    }
+
+    // number of blocks, the last of which may be partially used
+    std::size_t
+    block_count() const
+    {
+        return blocks_.size();
+    }
+
+    iterator
+    begin()
+    {
+        return iterator(this, 0);
+    }
+
+    iterator
+    end()
+    {
+        return iterator(this, size_);
+    }
+
+    const_iterator
+    begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    end() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    cend() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    void
+    push_back(const T& value)
+    {
+        assign_back(indices(), value.*MemberPtrValues...);
+    }
+
+    template <class... Elems>
+    void
+    push_back_members(Elems&&... elems)
+    {
+        assign_back(indices(), std::forward<Elems>(elems)...);
+    }
+
+    proxy_value_type operator[](std::size_t n)
+    {
+        return element(n, indices());
+    }
+
+    const_proxy_value_type operator[](std::size_t n) const
+    {
+        return element(n, indices());
+    }
+
+    // The Width values of a member in block b, for elements b * Width on.
+    // Lanes past size() in the last block hold unspecified values.
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    soa_detail::member_type_t<MemberPtrType>*
+    block_data(std::size_t b)
+    {
+        return std::get<member_index<MemberPtrType, MemberPtrValue>()>(
+                   blocks_[b].members)
+            .data();
+    }
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    const soa_detail::member_type_t<MemberPtrType>*
+    block_data(std::size_t b) const
+    {
+        return std::get<member_index<MemberPtrType, MemberPtrValue>()>(
+                   blocks_[b].members)
+            .data();
+    }
+
+    // Calls fn(n, pointers...) with pointers to the values of each of Members
+    // in a block, for every block, n being Width but for a partially used
+    // last block. Full blocks pass n as std::integral_constant<std::size_t,
+    // Width>, so a fn taking n as auto loops a fixed number of times.
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn)
+    {
+        for_each_block<Members...>(*this, 0, blocks_.size(), fn);
+    }
+
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn) const
+    {
+        for_each_block<Members...>(*this, 0, blocks_.size(), fn);
+    }
+
+    // Same as for_each_columns with the blocks spread over up to threads
+    // threads, so fn must be safe to call concurrently. Blocks start on a
+    // cache line, so no two threads write to the same one.
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency())
+    {
+        parallel_for(
+            blocks_.size(),
+            std::max<std::size_t>(1, soa_detail::parallel_chunk / Width),
+            [&](std::size_t first, std::size_t last) {
+                for_each_block<Members...>(*this, first, last, fn);
+            },
+            threads);
+    }
+
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        parallel_for(
+            blocks_.size(),
+            std::max<std::size_t>(1, soa_detail::parallel_chunk / Width),
+            [&](std::size_t first, std::size_t last) {
+                for_each_block<Members...>(*this, first, last, fn);
+            },
+            threads);
+    }
+
+    // as soa::transform
+    template <auto Out, auto... Ins, class Function>
+    void
+    transform(Function fn)
+    {
+        soa_detail::transform<Out, Ins...>(*this, fn);
+    }
+
+    // as soa::reduce
+    template <auto... Members,
+              class U,
+              class Reduce = std::plus<>,
+              class Map = soa_detail::identity>
+    U
+    reduce(U init, Reduce op = Reduce(), Map map = Map()) const
+    {
+        return soa_detail::reduce<Members...>(*this, init, op, map);
+    }
+
+    void
+    reserve(std::size_t n)
+    {
+        blocks_.reserve((n + Width - 1) / Width);
+    }
+
+    void
+    clear()
+    {
+        blocks_.clear();
+        size_ = 0;
+    }
+
+private:
+    std::vector<block_type> blocks_;
+    std::size_t size_;
+};
+} // namespace useful
@@ -0,0 +1,491 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "array_view.hpp"
+#include "soa.hpp"
+
+
+namespace useful
+{
+
+template <class T, class... MemberContainer>
+class arena_soa;
+
+// Struct-of-arrays with the same interface as soa, but with all member
+// columns in one allocation. Every column starts on a 64 byte boundary, at an
+// offset computed from the capacity, so growing or reserving is a single
+// allocation moving every column, instead of one per member.
+template <class T, class... MemberPtrTypes, MemberPtrTypes... MemberPtrValues>
+class arena_soa<T, member_container<MemberPtrTypes, MemberPtrValues>...>
+{
+public:
+    typedef T value_type;
+    typedef element_proxy<T,
+                          member_reference<MemberPtrTypes, MemberPtrValues>...>
+        proxy_value_type;
+    typedef const_element_proxy<
+        T,
+        member_reference<MemberPtrTypes, MemberPtrValues>...>
+        const_proxy_value_type;
+    typedef soa_iterator<arena_soa, proxy_value_type> iterator;
+    typedef soa_iterator<const arena_soa, const_proxy_value_type>
+        const_iterator;
+
+    // alignment of every column, a cache line
+    static constexpr std::size_t alignment = 64;
+
+private:
+    typedef std::tuple<soa_detail::member_type_t<MemberPtrTypes>...>
+        members_type;
+    typedef std::index_sequence_for<MemberPtrTypes...> indices;
+
+    template <std::size_t I>
+    using column_type = std::tuple_element_t<I, members_type>;
+
+    static_assert(((alignof(soa_detail::member_type_t<MemberPtrTypes>) <=
+                    alignment) &&
+                   ...),
+                  "arena_soa members must not be over-aligned");
+
+    // position of a member among the columns
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    static constexpr std::size_t
+    column_index()
+    {
+        return soa_detail::member_index<
+            member_reference<MemberPtrType, MemberPtrValue>,
+            member_reference<MemberPtrTypes, MemberPtrValues>...>();
+    }
+
+    // bytes before column in a block of the given capacity
+    static std::size_t
+    column_offset(std::size_t capacity, std::size_t column)
+    {
+        constexpr std::size_t sizes[] = {
+            sizeof(soa_detail::member_type_t<MemberPtrTypes>)...};
+
+        std::size_t offset = 0;
+        for(std::size_t i = 0; i < column; ++i)
+        {
+            offset += (capacity * sizes[i] + alignment - 1) / alignment *
+                      alignment;
+        }
+
+        return offset;
+    }
+
+    static std::byte*
+    allocate(std::size_t capacity)
+    {
+        return static_cast<std::byte*>(
+            ::operator new(column_offset(capacity, sizeof...(MemberPtrTypes)),
+                           std::align_val_t(alignment)));
+    }
+
+    static void
+    deallocate(std::byte* block)
+    {
+        ::operator delete(block, std::align_val_t(alignment));
+    }
+
+    template <std::size_t I>
+    column_type<I>*
+    column_data() const
+    {
+        return std::launder(reinterpret_cast<column_type<I>*>(
+            block_ + column_offset(capacity_, I)));
+    }
+
+    // destroys [first, last) of the first columns columns
+    template <std::size_t... Is>
+    void
+    destroy(std::size_t columns,
+            std::size_t first,
+            std::size_t last,
+            std::index_sequence<Is...>)
+    {
+        ((Is < columns ? std::destroy(column_data<Is>() + first,
+                                      column_data<Is>() + last)
+                       : void()),
+         ...);
+    }
+
+    // Constructs element n of every column from args, one per column.
+    // Columns constructed before an exception are destroyed again.
+    template <std::size_t... Is, class... Args>
+    void
+    construct(std::size_t n, std::index_sequence<Is...>, Args&&... args)
+    {
+        std::size_t constructed = 0;
+        try
+        {
+            ((::new(static_cast<void*>(column_data<Is>() + n))
+                  column_type<Is>(std::forward<Args>(args)),
+              ++constructed),
+             ...);
+        }
+        catch(...)
+        {
+            destroy(constructed, n, n + 1, indices());
+            throw;
+        }
+    }
+
+    // Copies column I of other into this, or moves it when that can't
+    // throw, like std::vector does on growth.
+    template <std::size_t I, class Other>
+    void
+    relocate_column(Other& other)
+    {
+        column_type<I>* first = other.template column_data<I>();
+
+        if constexpr(!std::is_const<Other>::value &&
+                     (std::is_nothrow_move_constructible<
+                          column_type<I>>::value ||
+                      !std::is_copy_constructible<column_type<I>>::value))
+        {
+            std::uninitialized_move(
+                first, first + other.size_, column_data<I>());
+        }
+        else
+        {
+            std::uninitialized_copy(
+                first, first + other.size_, column_data<I>());
+        }
+    }
+
+    // Fills the fresh block of this, holding no elements, with the elements
+    // of other. Columns relocated before an exception are destroyed again.
+    template <class Other, std::size_t... Is>
+    void
+    relocate_from(Other& other, std::index_sequence<Is...>)
+    {
+        std::size_t relocated = 0;
+        try
+        {
+            ((relocate_column<Is>(other), ++relocated), ...);
+        }
+        catch(...)
+        {
+            destroy(relocated, 0, other.size_, indices());
+            throw;
+        }
+    }
+
+    // capacity to grow to for room for at least n elements
+    std::size_t
+    grown_capacity(std::size_t n) const
+    {
+        return std::max(n, capacity_ * 2);
+    }
+
+    // Appends an element constructed from args, one per column. args may
+    // refer to elements of this, so on growth the new element is
+    // constructed in the new block before the old ones are relocated.
+    template <class... Args>
+    void
+    append(Args&&... args)
+    {
+        if(size_ < capacity_)
+        {
+            construct(size_, indices(), std::forward<Args>(args)...);
+            ++size_;
+            return;
+        }
+
+        arena_soa grown;
+        grown.capacity_ = grown_capacity(size_ + 1);
+        grown.block_ = allocate(grown.capacity_);
+
+        grown.construct(size_, indices(), std::forward<Args>(args)...);
+        try
+        {
+            grown.relocate_from(*this, indices());
+        }
+        catch(...)
+        {
+            grown.destroy(
+                sizeof...(MemberPtrTypes), size_, size_ + 1, indices());
+            throw;
+        }
+        grown.size_ = size_ + 1;
+
+        std::swap(block_, grown.block_);
+        std::swap(size_, grown.size_);
+        std::swap(capacity_, grown.capacity_);
+    }
+
+public:
+    arena_soa() : block_(nullptr), size_(0), capacity_(0)
+    {
+    }
+
+    arena_soa(const arena_soa& other) : arena_soa()
+    {
+        if(other.size_ > 0)
+        {
+            // the destructor frees the block if relocating throws
+            block_ = allocate(other.size_);
+            capacity_ = other.size_;
+
+            relocate_from(other, indices());
+            size_ = other.size_;
+        }
+    }
+
+    arena_soa(arena_soa&& other) noexcept
+        : block_(other.block_), size_(other.size_), capacity_(other.capacity_)
+    {
+        other.block_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+
+    arena_soa&
+    operator=(arena_soa other) noexcept
+    {
+        std::swap(block_, other.block_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        return *this;
+    }
+
+    ~arena_soa()
+    {
+        if(block_)
+        {
+            clear();
+            deallocate(block_);
+        }
+    }
+
+    std::size_t
+    size() const
+    {
+        return size_;
+    }
+
+    std::size_t
+    capacity() const
+    {
+        return capacity_;
+    }
+
+    bool
+    empty() const
+    {
+        return size_ == 0;
+    }
+
+    iterator
+    begin()
+    {
+        return iterator(this, 0);
+    }
+
+    iterator
+    end()
+    {
+        return iterator(this, size_);
+    }
+
+    const_iterator
+    begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    end() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    cend() const
+    {
+        return const_iterator(this, size_);
+    }
+
+    // Moves every column to a single new block with room for n elements.
+    void reserve(std::size_t n);
+
+    void
+    clear()
+    {
+        destroy(sizeof...(MemberPtrTypes), 0, size_, indices());
+        size_ = 0;
+    }
+
+    void
+    push_back(const T& value)
+    {
+        append(value.*MemberPtrValues...);
+    }
+
+    // elems may refer to elements of this arena_soa
+    template <class... Elems>
+    void
+    push_back_members(Elems&&... elems)
+    {
+        append(std::forward<Elems>(elems)...);
+    }
+
+    proxy_value_type operator[](std::size_t n)
+    {
+        return element(n, indices());
+    }
+
+    const_proxy_value_type operator[](std::size_t n) const
+    {
+        return element(n, indices());
+    }
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    soa_detail::member_type_t<MemberPtrType>*
+    data()
+    {
+        return column_data<column_index<MemberPtrType, MemberPtrValue>()>();
+    }
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    const soa_detail::member_type_t<MemberPtrType>*
+    data() const
+    {
+        return column_data<column_index<MemberPtrType, MemberPtrValue>()>();
+    }
+
+    // Calls fn(n, pointers...) with pointers to n consecutive values of each
+    // of Members, for chunks of soa_detail::kernel_chunk elements covering
+    // the soa, the last one possibly shorter. Every chunk starts on a 64 byte
+    // boundary.
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn)
+    {
+        soa_detail::for_each_chunk<soa_detail::kernel_chunk>(
+            size_, fn, data<decltype(Members), Members>()...);
+    }
+
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn) const
+    {
+        soa_detail::for_each_chunk<soa_detail::kernel_chunk>(
+            size_, fn, data<decltype(Members), Members>()...);
+    }
+
+    // as soa::parallel_for_each_columns; with every column aligned, no two
+    // threads write to the same cache line
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency())
+    {
+        soa_detail::parallel_for_each_chunk(
+            size_, fn, threads, data<decltype(Members), Members>()...);
+    }
+
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        soa_detail::parallel_for_each_chunk(
+            size_, fn, threads, data<decltype(Members), Members>()...);
+    }
+
+    // as soa::transform
+    template <auto Out, auto... Ins, class Function>
+    void
+    transform(Function fn)
+    {
+        soa_detail::transform<Out, Ins...>(*this, fn);
+    }
+
+    // as soa::reduce
+    template <auto... Members,
+              class U,
+              class Reduce = std::plus<>,
+              class Map = soa_detail::identity>
+    U
+    reduce(U init, Reduce op = Reduce(), Map map = Map()) const
+    {
+        return soa_detail::reduce<Members...>(*this, init, op, map);
+    }
+
+    // all values of one member, contiguous and aligned to alignment
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    array_view<soa_detail::member_type_t<MemberPtrType>>
+    column()
+    {
+        return array_view<soa_detail::member_type_t<MemberPtrType>>(
+            data<MemberPtrType, MemberPtrValue>(), size_);
+    }
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    array_view<const soa_detail::member_type_t<MemberPtrType>>
+    column() const
+    {
+        return array_view<const soa_detail::member_type_t<MemberPtrType>>(
+            data<MemberPtrType, MemberPtrValue>(), size_);
+    }
+
+private:
+    template <std::size_t... Is>
+    proxy_value_type
+    element(std::size_t n, std::index_sequence<Is...>)
+    {
+        return proxy_value_type(column_data<Is>()[n]...);
+    }
+
+    template <std::size_t... Is>
+    const_proxy_value_type
+    element(std::size_t n, std::index_sequence<Is...>) const
+    {
+        return const_proxy_value_type(column_data<Is>()[n]...);
+    }
+
+    std::byte* block_;
+    std::size_t size_;
+    std::size_t capacity_;
+};
+
+
+template <class T, class... MemberPtrTypes, MemberPtrTypes... MemberPtrValues>
+void
+arena_soa<T, member_container<MemberPtrTypes, MemberPtrValues>...>::reserve(
+    std::size_t n)
+{
+    if(n <= capacity_)
+    {
+        return;
+    }
+
+    arena_soa grown;
+    grown.block_ = allocate(n);
+    grown.capacity_ = n;
+
+    grown.relocate_from(*this, indices());
+    grown.size_ = size_;
+
+    std::swap(block_, grown.block_);
+    std::swap(size_, grown.size_);
+    std::swap(capacity_, grown.capacity_);
+}
+} // namespace useful
@@ -29,6 +29,10 @@ public:
     {
     }
 
+    array_view(T* first, size_type n) : decayed_(first), size_(n)
+    {
+    }
+
     size_type
     size() const
     {
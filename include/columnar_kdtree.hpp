@@ -0,0 +1,543 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "point_traits.hpp"
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// Immutable kdtree whose leaves hold up to BucketSize points. Coordinates
+// are additionally kept column-wise, one contiguous array per dimension, so
+// leaves are scanned by simple loops over each column that the compiler can
+// vectorize.
+//
+// Distances are computed by folding metric.axis(offset) of every dimension
+// with metric.combine, which gives the distance of squared_euclidean,
+// manhattan and chebyshev.
+template <class PointType, std::size_t BucketSize = 32>
+class columnar_kdtree
+{
+    static_assert(BucketSize > 0, "BucketSize must be at least 1");
+
+public:
+    typedef typename std::vector<PointType>::size_type size_type;
+    typedef typename std::vector<PointType>::const_iterator const_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+    static constexpr std::size_t dimensions =
+        point_traits<PointType>::dimensions;
+    static constexpr std::size_t bucket_size = BucketSize;
+
+private:
+    // internal nodes split [first, last) on dim, leaves have no children
+    struct node
+    {
+        distance_type split;
+        std::size_t dim;
+        size_type first;
+        size_type last;
+        size_type smaller;
+        size_type bigger;
+    };
+
+    size_type build_helper(size_type first, size_type last, size_type level);
+
+    // Same protocol as kdtree_detail::search, except that instead of
+    // visit(index) the query is handed a whole leaf with scan(first, last).
+    template <class Query>
+    void search(Query& query) const;
+
+    template <class Metric>
+    void leaf_distances(const PointType& target,
+                        size_type first,
+                        size_type last,
+                        distance_type* out,
+                        const Metric& metric) const;
+
+    template <class Metric>
+    struct nearest_query;
+
+    template <class OutputIterator>
+    struct range_query_;
+
+    template <class OutputIterator, class Metric>
+    struct radius_query_;
+
+public:
+    columnar_kdtree() = default;
+
+    template <class InputIterator>
+    columnar_kdtree(InputIterator first, InputIterator last);
+
+    bool
+    empty() const
+    {
+        return points_.empty();
+    }
+
+    size_type
+    size() const
+    {
+        return points_.size();
+    }
+
+    const_iterator
+    begin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    end() const
+    {
+        return points_.cend();
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    cend() const
+    {
+        return points_.cend();
+    }
+
+    // contiguous coordinates of dimension dim, in the order of begin()/end()
+    const distance_type*
+    column(std::size_t dim) const
+    {
+        return columns_[dim].data();
+    }
+
+    template <class Metric = squared_euclidean>
+    const_iterator nearest(const PointType& pt,
+                           Metric metric = Metric()) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    template <class OutputIterator>
+    OutputIterator range_query(const PointType& min_pt,
+                               const PointType& max_pt,
+                               OutputIterator out) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator radius_query(const PointType& center,
+                                distance_type r,
+                                OutputIterator out,
+                                Metric metric = Metric()) const;
+
+private:
+    std::vector<PointType> points_;
+    std::array<std::vector<distance_type>, dimensions> columns_;
+    std::vector<node> nodes_;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType, std::size_t BucketSize>
+template <class InputIterator>
+columnar_kdtree<PointType, BucketSize>::columnar_kdtree(InputIterator first,
+                                                        InputIterator last)
+    : points_(first, last)
+{
+    if(points_.empty())
+    {
+        return;
+    }
+
+    nodes_.reserve(2ul * (points_.size() / BucketSize + 1ul));
+    build_helper(0ul, points_.size(), 0ul);
+
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        columns_[dim].resize(points_.size());
+        for(size_type i = 0; i < points_.size(); ++i)
+        {
+            columns_[dim][i] = coordinate(points_[i], dim);
+        }
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+typename columnar_kdtree<PointType, BucketSize>::size_type
+columnar_kdtree<PointType, BucketSize>::build_helper(size_type first,
+                                                     size_type last,
+                                                     size_type level)
+{
+    const size_type index = nodes_.size();
+    nodes_.push_back(node{distance_type(), 0ul, first, last, 0ul, 0ul});
+
+    if(last - first <= BucketSize)
+    {
+        return index;
+    }
+
+    const std::size_t dim = level % dimensions;
+    const size_type median = first + (last - first) / 2ul;
+
+    std::nth_element(points_.begin() + first,
+                     points_.begin() + median,
+                     points_.begin() + last,
+                     [dim](const PointType& lhs, const PointType& rhs) {
+                         return less(lhs, rhs, dim);
+                     });
+
+    nodes_[index].split = coordinate(points_[median], dim);
+    nodes_[index].dim = dim;
+
+    const size_type smaller = build_helper(first, median, level + 1ul);
+    const size_type bigger = build_helper(median, last, level + 1ul);
+
+    nodes_[index].smaller = smaller;
+    nodes_[index].bigger = bigger;
+
+    return index;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Query>
+void
+columnar_kdtree<PointType, BucketSize>::search(Query& query) const
+{
+    if(nodes_.empty())
+    {
+        return;
+    }
+
+    std::vector<kdtree_detail::search_entry<size_type, distance_type>>&
+        stack = kdtree_detail::search_stack<size_type, distance_type>();
+    stack.clear();
+    stack.push_back({0ul, 0ul, distance_type()});
+
+    while(!stack.empty())
+    {
+        const kdtree_detail::search_entry<size_type, distance_type> current =
+            stack.back();
+        stack.pop_back();
+
+        if(query.prune(current.bound))
+        {
+            continue;
+        }
+
+        const node& n = nodes_[current.index];
+
+        if(!n.smaller)
+        {
+            query.scan(n.first, n.last);
+            continue;
+        }
+
+        const std::pair<distance_type, distance_type> bounds =
+            query.bounds(n.split, n.dim, current.bound);
+
+        if(bounds.first < bounds.second)
+        {
+            if(!query.prune(bounds.second))
+            {
+                stack.push_back({n.bigger, 0ul, bounds.second});
+            }
+            if(!query.prune(bounds.first))
+            {
+                stack.push_back({n.smaller, 0ul, bounds.first});
+            }
+        }
+        else
+        {
+            if(!query.prune(bounds.first))
+            {
+                stack.push_back({n.smaller, 0ul, bounds.first});
+            }
+            if(!query.prune(bounds.second))
+            {
+                stack.push_back({n.bigger, 0ul, bounds.second});
+            }
+        }
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+void
+columnar_kdtree<PointType, BucketSize>::leaf_distances(
+    const PointType& target,
+    size_type first,
+    size_type last,
+    distance_type* out,
+    const Metric& metric) const
+{
+    const size_type count = last - first;
+
+    std::fill(out, out + count, distance_type());
+
+    // one pass per column keeps every inner loop a contiguous, branch free
+    // stream the compiler can vectorize
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        const distance_type value = coordinate(target, dim);
+        const distance_type* col = columns_[dim].data() + first;
+
+        for(size_type i = 0; i < count; ++i)
+        {
+            out[i] = metric.combine(
+                out[i], metric.axis(absolute_difference(col[i], value)));
+        }
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+struct columnar_kdtree<PointType, BucketSize>::nearest_query
+{
+    bool
+    prune(distance_type bound) const
+    {
+        return heap.full() && !(bound < heap.worst());
+    }
+
+    void
+    scan(size_type first, size_type last)
+    {
+        distance_type distances[BucketSize];
+        tree.leaf_distances(target, first, last, distances, metric);
+
+        for(size_type i = first; i < last; ++i)
+        {
+            heap.push(distances[i - first], i);
+        }
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(distance_type split, std::size_t dim, distance_type parent) const
+    {
+        const distance_type value = coordinate(target, dim);
+        const distance_type far =
+            std::max(parent, metric.axis(absolute_difference(value, split)));
+
+        if(value < split)
+        {
+            return {parent, far};
+        }
+
+        return {far, parent};
+    }
+
+    const columnar_kdtree& tree;
+    const PointType& target;
+    Metric metric;
+    neighbour_heap<distance_type, size_type>& heap;
+};
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator>
+struct columnar_kdtree<PointType, BucketSize>::range_query_
+{
+    // bounds are 0 for subtrees overlapping the box and 1 otherwise
+    bool
+    prune(distance_type bound) const
+    {
+        return distance_type() < bound;
+    }
+
+    void
+    scan(size_type first, size_type last)
+    {
+        const size_type count = last - first;
+
+        bool inside[BucketSize];
+        std::fill(inside, inside + count, true);
+
+        for(std::size_t dim = 0; dim < dimensions; ++dim)
+        {
+            const distance_type low = coordinate(min_pt, dim);
+            const distance_type high = coordinate(max_pt, dim);
+            const distance_type* col = tree.columns_[dim].data() + first;
+
+            for(size_type i = 0; i < count; ++i)
+            {
+                inside[i] = inside[i] & (low <= col[i]) & (col[i] <= high);
+            }
+        }
+
+        for(size_type i = 0; i < count; ++i)
+        {
+            if(inside[i])
+            {
+                *out++ = tree.points_[first + i];
+            }
+        }
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(distance_type split, std::size_t dim, distance_type) const
+    {
+        return {coordinate(min_pt, dim) <= split ? distance_type()
+                                                 : distance_type(1),
+                split <= coordinate(max_pt, dim) ? distance_type()
+                                                 : distance_type(1)};
+    }
+
+    const columnar_kdtree& tree;
+    const PointType& min_pt;
+    const PointType& max_pt;
+    OutputIterator out;
+};
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+struct columnar_kdtree<PointType, BucketSize>::radius_query_
+{
+    bool
+    prune(distance_type bound) const
+    {
+        return radius < bound;
+    }
+
+    void
+    scan(size_type first, size_type last)
+    {
+        distance_type distances[BucketSize];
+        tree.leaf_distances(center, first, last, distances, metric);
+
+        for(size_type i = first; i < last; ++i)
+        {
+            if(!(radius < distances[i - first]))
+            {
+                *out++ = tree.points_[i];
+            }
+        }
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(distance_type split, std::size_t dim, distance_type parent) const
+    {
+        const distance_type value = coordinate(center, dim);
+        const distance_type far =
+            std::max(parent, metric.axis(absolute_difference(value, split)));
+
+        if(value < split)
+        {
+            return {parent, far};
+        }
+
+        return {far, parent};
+    }
+
+    const columnar_kdtree& tree;
+    const PointType& center;
+    distance_type radius;
+    Metric metric;
+    OutputIterator out;
+};
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+typename columnar_kdtree<PointType, BucketSize>::const_iterator
+columnar_kdtree<PointType, BucketSize>::nearest(const PointType& pt,
+                                                Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, 1ul, heap, metric);
+
+    if(heap.empty())
+    {
+        return points_.cend();
+    }
+
+    return points_.cbegin() + heap.begin()->index;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+OutputIterator
+columnar_kdtree<PointType, BucketSize>::k_nearest(const PointType& pt,
+                                                  size_type k,
+                                                  OutputIterator out,
+                                                  Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+void
+columnar_kdtree<PointType, BucketSize>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul)
+    {
+        return;
+    }
+
+    nearest_query<Metric> query{*this, pt, metric, heap};
+    search(query);
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator>
+OutputIterator
+columnar_kdtree<PointType, BucketSize>::range_query(const PointType& min_pt,
+                                                    const PointType& max_pt,
+                                                    OutputIterator out) const
+{
+    range_query_<OutputIterator> query{*this, min_pt, max_pt, out};
+    search(query);
+
+    return query.out;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+OutputIterator
+columnar_kdtree<PointType, BucketSize>::radius_query(const PointType& center,
+                                                     distance_type r,
+                                                     OutputIterator out,
+                                                     Metric metric) const
+{
+    radius_query_<OutputIterator, Metric> query{*this, center, r, metric, out};
+    search(query);
+
+    return query.out;
+}
+} // namespace multidim
+} // namespace useful
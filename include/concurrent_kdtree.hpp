@@ -0,0 +1,250 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// A kdtree shared between any number of reading threads and a single writing
+// thread without locks on the read path.
+//
+// Two copies of the tree are kept. Readers pin the published copy for the
+// lifetime of a reader object and never see it change. The writer buffers
+// inserts and applies them to the other copy on publish, which then becomes
+// the published copy. Readers announce the epoch they entered in one of
+// MaxReaders slots, which tells the writer when the copy it retired is no
+// longer read and may be brought up to date for the next publish.
+template <class PointType, std::size_t MaxReaders = 64>
+class concurrent_kdtree
+{
+    struct alignas(64) reader_slot
+    {
+        // epoch the reader entered in, 0 while the slot is free
+        std::atomic<std::uint64_t> epoch{0u};
+    };
+
+public:
+    typedef kdtree<PointType> tree_type;
+    typedef typename tree_type::size_type size_type;
+
+    // Pins the published tree while alive. Cheap to create, intended to be
+    // held for the duration of one or a few queries.
+    class reader
+    {
+    public:
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        reader(reader&& other) : slot_(other.slot_), tree_(other.tree_)
+        {
+            other.slot_ = nullptr;
+        }
+
+        ~reader()
+        {
+            if(slot_)
+            {
+                slot_->epoch.store(0u);
+            }
+        }
+
+        const tree_type& operator*() const
+        {
+            return *tree_;
+        }
+
+        const tree_type* operator->() const
+        {
+            return tree_;
+        }
+
+    private:
+        friend class concurrent_kdtree;
+
+        reader(reader_slot* slot, const tree_type* tree)
+            : slot_(slot), tree_(tree)
+        {
+        }
+
+        reader_slot* slot_;
+        const tree_type* tree_;
+    };
+
+private:
+    reader_slot& acquire_slot() const;
+
+    // blocks until no reader entered before epoch
+    void wait_for_readers(std::uint64_t epoch) const;
+
+public:
+    concurrent_kdtree() = default;
+
+    template <class InputIterator>
+    concurrent_kdtree(InputIterator first, InputIterator last);
+
+    concurrent_kdtree(const concurrent_kdtree&) = delete;
+    concurrent_kdtree& operator=(const concurrent_kdtree&) = delete;
+
+    // may be called from any thread
+    reader read() const;
+
+    // The remaining functions must only be called by the writing thread.
+
+    void
+    insert(const PointType& pt)
+    {
+        pending_.push_back(pt);
+    }
+
+    template <class InputIterator>
+    void
+    insert(InputIterator first, InputIterator last)
+    {
+        pending_.insert(pending_.end(), first, last);
+    }
+
+    // number of inserts not yet visible to readers
+    size_type
+    pending() const
+    {
+        return pending_.size();
+    }
+
+    // Makes all pending inserts visible to readers entering from now on.
+    // Only waits for readers that entered before the previous publish.
+    void publish();
+
+private:
+    std::array<tree_type, 2> trees_;
+    std::atomic<unsigned> published_{0u};
+    std::atomic<std::uint64_t> epoch_{1u};
+    mutable std::array<reader_slot, MaxReaders> slots_;
+
+    // epoch at which the unpublished tree was retired
+    std::uint64_t retired_epoch_ = 1u;
+    // inserts published in the other tree but not yet applied to this one
+    std::vector<PointType> lagging_;
+    std::vector<PointType> pending_;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType, std::size_t MaxReaders>
+template <class InputIterator>
+concurrent_kdtree<PointType, MaxReaders>::concurrent_kdtree(
+    InputIterator first, InputIterator last)
+{
+    trees_[0].build(first, last);
+    trees_[1] = trees_[0];
+}
+
+template <class PointType, std::size_t MaxReaders>
+typename concurrent_kdtree<PointType, MaxReaders>::reader_slot&
+concurrent_kdtree<PointType, MaxReaders>::acquire_slot() const
+{
+    // start probing where this thread is likely to find its last slot
+    const std::size_t start =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % MaxReaders;
+
+    for(;;)
+    {
+        for(std::size_t i = 0; i < MaxReaders; ++i)
+        {
+            reader_slot& slot = slots_[(start + i) % MaxReaders];
+            std::uint64_t expected = 0u;
+
+            // claim with an epoch no writer waits for, the real epoch is
+            // announced by read
+            if(slot.epoch.compare_exchange_strong(
+                   expected, std::numeric_limits<std::uint64_t>::max()))
+            {
+                return slot;
+            }
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+template <class PointType, std::size_t MaxReaders>
+typename concurrent_kdtree<PointType, MaxReaders>::reader
+concurrent_kdtree<PointType, MaxReaders>::read() const
+{
+    reader_slot& slot = acquire_slot();
+
+    // the announced epoch must be current when the tree is picked, otherwise
+    // the writer may already have stopped waiting for it
+    std::uint64_t epoch = epoch_.load();
+    for(;;)
+    {
+        slot.epoch.store(epoch);
+
+        const std::uint64_t current = epoch_.load();
+        if(current == epoch)
+        {
+            break;
+        }
+
+        epoch = current;
+    }
+
+    return reader(&slot, &trees_[published_.load()]);
+}
+
+template <class PointType, std::size_t MaxReaders>
+void
+concurrent_kdtree<PointType, MaxReaders>::wait_for_readers(
+    std::uint64_t epoch) const
+{
+    for(const reader_slot& slot : slots_)
+    {
+        for(std::uint64_t entered = slot.epoch.load();
+            entered != 0u && entered < epoch;
+            entered = slot.epoch.load())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template <class PointType, std::size_t MaxReaders>
+void
+concurrent_kdtree<PointType, MaxReaders>::publish()
+{
+    if(pending_.empty() && lagging_.empty())
+    {
+        return;
+    }
+
+    const unsigned next = 1u - published_.load();
+    tree_type& tree = trees_[next];
+
+    // readers that may still hold the retired tree entered before it was
+    // retired
+    wait_for_readers(retired_epoch_);
+
+    tree.insert(lagging_.begin(), lagging_.end());
+    tree.insert(pending_.begin(), pending_.end());
+
+    published_.store(next);
+    retired_epoch_ = epoch_.fetch_add(1u) + 1u;
+
+    lagging_.swap(pending_);
+    pending_.clear();
+}
+} // namespace multidim
+} // namespace useful
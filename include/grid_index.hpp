@@ -0,0 +1,710 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include "point_traits.hpp"
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// Uniform grid of cubic cells with side cell_size, for dense and evenly
+// spread points in few dimensions. Points are kept sorted by cell in one
+// contiguous array, and a rebuild is a counting sort over the cells taking
+// linear time, which suits points that move every frame. Storage is reused
+// between rebuilds.
+//
+// When the box of occupied cells has at most dense_cells_per_point cells per
+// point, every cell of the box gets a bucket in row-major order, so the
+// cells along the last dimension are contiguous in memory. Otherwise cells
+// are hashed into about one bucket per point, so only occupied cells cost
+// memory, and points of cells sharing a bucket are filtered by distance.
+//
+// Queries visit the cells around the query point ring by ring, staying
+// inside the box of occupied cells. They are fastest with a few points per
+// cell, and a cell about as wide as the distance to the k-th neighbour. On a
+// hashed grid, a query whose rings would span more cells than there are
+// buckets scans the remaining buckets instead, bounding its cost by the
+// number of points rather than the size of the box.
+template <class PointType>
+class grid_index
+{
+public:
+    typedef typename std::vector<PointType>::size_type size_type;
+    typedef typename std::vector<PointType>::const_iterator const_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+    static constexpr std::size_t dimensions =
+        point_traits<PointType>::dimensions;
+    static constexpr size_type dense_cells_per_point = 4ul;
+
+    typedef std::array<std::int64_t, dimensions> cell_type;
+
+private:
+    // Marks the buckets already scanned by a query on a hashed grid, so a
+    // bucket reached through several of its cells is only scanned once.
+    struct visit_marks
+    {
+        std::vector<std::uint32_t> marks;
+        std::uint32_t stamp = 0u;
+    };
+
+    static visit_marks& scratch_marks();
+
+    // starts a query, clearing the marks of a hashed grid
+    void begin_visits() const;
+
+    size_type bucket(const cell_type& c) const;
+
+    // Calls visit(first, last) with the range of points of every row of
+    // cells along the last dimension, inside the occupied cells, whose
+    // largest offset from center is exactly ring.
+    template <class Visit>
+    void for_each_shell_row(const cell_type& center,
+                            std::int64_t ring,
+                            Visit& visit) const;
+
+    template <class Visit>
+    void shell_helper(cell_type& c,
+                      std::size_t dim,
+                      bool on_shell,
+                      const cell_type& center,
+                      std::int64_t ring,
+                      Visit& visit) const;
+
+    template <class Visit>
+    void visit_row(cell_type& c,
+                   std::int64_t first,
+                   std::int64_t last,
+                   Visit& visit) const;
+
+    // first ring around center reaching an occupied cell
+    std::int64_t first_ring(const cell_type& center) const;
+
+    // whether the cube of cells within ring of center covers every occupied
+    // cell
+    bool covers(const cell_type& center, std::int64_t ring) const;
+
+    // cells of the cube within ring of center that are inside the occupied
+    // cells
+    double cube_cells(const cell_type& center, std::int64_t ring) const;
+
+    // Calls visit(first, last) with the points of every bucket of a hashed
+    // grid not yet visited by the query.
+    template <class Visit>
+    void visit_remaining(Visit& visit) const;
+
+    // whether walking ring would cost more than scanning every bucket, as
+    // for sparse points far apart in a hashed grid
+    bool
+    scan_instead(const cell_type& center, std::int64_t ring) const
+    {
+        return hashed_ && cube_cells(center, ring) >
+                              static_cast<double>(bucket_count());
+    }
+
+    // distance from pt to the nearest face of its cell
+    double inner_gap(const PointType& pt, const cell_type& c) const;
+
+public:
+    // cell_size must be positive
+    explicit grid_index(double cell_size);
+
+    template <class InputIterator>
+    grid_index(InputIterator first, InputIterator last, double cell_size);
+
+    // Replaces the points of the grid with [first, last) in linear time.
+    template <class InputIterator>
+    void rebuild(InputIterator first, InputIterator last);
+
+    double
+    cell_size() const
+    {
+        return cell_size_;
+    }
+
+    cell_type cell(const PointType& pt) const;
+
+    bool
+    empty() const
+    {
+        return points_.empty();
+    }
+
+    size_type
+    size() const
+    {
+        return points_.size();
+    }
+
+    size_type
+    bucket_count() const
+    {
+        return offsets_.empty() ? 0ul : offsets_.size() - 1ul;
+    }
+
+    // whether cells are hashed rather than laid out densely
+    bool
+    hashed() const
+    {
+        return hashed_;
+    }
+
+    // points in bucket order
+    const_iterator
+    begin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    end() const
+    {
+        return points_.cend();
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    cend() const
+    {
+        return points_.cend();
+    }
+
+    // position in the range last passed to rebuild of the point at
+    // cbegin() + index
+    size_type
+    source_index(size_type index) const
+    {
+        return sources_[index];
+    }
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    // Indices in the heap are positions from cbegin().
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    // Writes every point within distance r of center to out, in no particular
+    // order. r is measured by metric, so for the default squared_euclidean
+    // it is the squared radius.
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator radius_query(const PointType& center,
+                                distance_type r,
+                                OutputIterator out,
+                                Metric metric = Metric()) const;
+
+private:
+    double cell_size_;
+    double inverse_cell_size_;
+    bool hashed_ = false;
+
+    // smallest and largest occupied cell in every dimension
+    cell_type low_;
+    cell_type high_;
+    // row-major strides of the occupied cells when not hashed
+    std::array<size_type, dimensions> strides_;
+
+    std::vector<PointType> points_;
+    std::vector<size_type> sources_;
+    // points of bucket b are at [offsets_[b], offsets_[b + 1])
+    std::vector<size_type> offsets_;
+
+    // reused by rebuild
+    std::vector<PointType> unsorted_;
+    std::vector<size_type> buckets_;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType>
+grid_index<PointType>::grid_index(double cell_size)
+    : cell_size_(cell_size), inverse_cell_size_(1.0 / cell_size)
+{
+    if(!(cell_size > 0.0))
+    {
+        throw std::runtime_error("grid_index: cell size must be positive");
+    }
+}
+
+template <class PointType>
+template <class InputIterator>
+grid_index<PointType>::grid_index(InputIterator first,
+                                  InputIterator last,
+                                  double cell_size)
+    : grid_index(cell_size)
+{
+    rebuild(first, last);
+}
+
+template <class PointType>
+typename grid_index<PointType>::visit_marks&
+grid_index<PointType>::scratch_marks()
+{
+    thread_local visit_marks marks;
+    return marks;
+}
+
+template <class PointType>
+void
+grid_index<PointType>::begin_visits() const
+{
+    if(!hashed_)
+    {
+        return;
+    }
+
+    visit_marks& scratch = scratch_marks();
+    if(scratch.marks.size() < bucket_count())
+    {
+        scratch.marks.resize(bucket_count(), 0u);
+    }
+
+    // a wrapped stamp could match marks left by earlier queries
+    if(++scratch.stamp == 0u)
+    {
+        std::fill(scratch.marks.begin(), scratch.marks.end(), 0u);
+        scratch.stamp = 1u;
+    }
+}
+
+template <class PointType>
+typename grid_index<PointType>::cell_type
+grid_index<PointType>::cell(const PointType& pt) const
+{
+    cell_type out;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        out[dim] = static_cast<std::int64_t>(std::floor(
+            static_cast<double>(coordinate(pt, dim)) * inverse_cell_size_));
+    }
+
+    return out;
+}
+
+template <class PointType>
+typename grid_index<PointType>::size_type
+grid_index<PointType>::bucket(const cell_type& c) const
+{
+    if(!hashed_)
+    {
+        size_type out = 0ul;
+        for(std::size_t dim = 0; dim < dimensions; ++dim)
+        {
+            out += static_cast<size_type>(c[dim] - low_[dim]) * strides_[dim];
+        }
+
+        return out;
+    }
+
+    std::uint64_t hash = 0u;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        hash = (hash ^ static_cast<std::uint64_t>(c[dim])) *
+               0x9e3779b97f4a7c15u;
+    }
+
+    // bucket_count is a power of two
+    return static_cast<size_type>(hash ^ (hash >> 32u)) &
+           (bucket_count() - 1ul);
+}
+
+template <class PointType>
+template <class InputIterator>
+void
+grid_index<PointType>::rebuild(InputIterator first, InputIterator last)
+{
+    unsorted_.assign(first, last);
+    const size_type n = unsorted_.size();
+
+    points_.clear();
+    sources_.resize(n);
+    buckets_.resize(n);
+
+    if(n == 0ul)
+    {
+        offsets_.clear();
+        return;
+    }
+
+    low_ = high_ = cell(unsorted_.front());
+    for(const PointType& pt : unsorted_)
+    {
+        const cell_type c = cell(pt);
+        for(std::size_t dim = 0; dim < dimensions; ++dim)
+        {
+            low_[dim] = std::min(low_[dim], c[dim]);
+            high_[dim] = std::max(high_[dim], c[dim]);
+        }
+    }
+
+    // in double, the box may hold more cells than size_type can count
+    double cells = 1.0;
+    for(std::size_t dim = dimensions; dim-- > 0ul;)
+    {
+        strides_[dim] = static_cast<size_type>(cells);
+        cells *= static_cast<double>(high_[dim] - low_[dim]) + 1.0;
+    }
+
+    size_type count = 1ul;
+    hashed_ = cells > static_cast<double>(n * dense_cells_per_point);
+    if(hashed_)
+    {
+        // about one point per bucket
+        while(count < n)
+        {
+            count *= 2ul;
+        }
+    }
+    else
+    {
+        count = static_cast<size_type>(cells);
+    }
+
+    offsets_.assign(count + 1ul, 0ul);
+
+    for(size_type i = 0; i < n; ++i)
+    {
+        buckets_[i] = bucket(cell(unsorted_[i]));
+        ++offsets_[buckets_[i] + 1ul];
+    }
+
+    std::partial_sum(offsets_.begin(), offsets_.end(), offsets_.begin());
+
+    // offsets_[b] is advanced from the start to the end of bucket b
+    for(size_type i = 0; i < n; ++i)
+    {
+        sources_[offsets_[buckets_[i]]++] = i;
+    }
+
+    std::copy_backward(offsets_.begin(), offsets_.end() - 1, offsets_.end());
+    offsets_[0] = 0ul;
+
+    points_.reserve(n);
+    for(size_type i = 0; i < n; ++i)
+    {
+        points_.push_back(unsorted_[sources_[i]]);
+    }
+}
+
+template <class PointType>
+std::int64_t
+grid_index<PointType>::first_ring(const cell_type& center) const
+{
+    std::int64_t ring = 0;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        ring = std::max(
+            {ring, low_[dim] - center[dim], center[dim] - high_[dim]});
+    }
+
+    return ring;
+}
+
+template <class PointType>
+bool
+grid_index<PointType>::covers(const cell_type& center,
+                              std::int64_t ring) const
+{
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        if(low_[dim] < center[dim] - ring || center[dim] + ring < high_[dim])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <class PointType>
+double
+grid_index<PointType>::cube_cells(const cell_type& center,
+                                  std::int64_t ring) const
+{
+    double out = 1.0;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        out *= static_cast<double>(std::min(high_[dim], center[dim] + ring) -
+                                   std::max(low_[dim], center[dim] - ring)) +
+               1.0;
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Visit>
+void
+grid_index<PointType>::visit_remaining(Visit& visit) const
+{
+    visit_marks& scratch = scratch_marks();
+    for(size_type b = 0; b < bucket_count(); ++b)
+    {
+        if(scratch.marks[b] != scratch.stamp)
+        {
+            scratch.marks[b] = scratch.stamp;
+            visit(offsets_[b], offsets_[b + 1ul]);
+        }
+    }
+}
+
+template <class PointType>
+double
+grid_index<PointType>::inner_gap(const PointType& pt,
+                                 const cell_type& c) const
+{
+    double gap = cell_size_;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        const double offset =
+            static_cast<double>(coordinate(pt, dim)) -
+            static_cast<double>(c[dim]) * cell_size_;
+        gap = std::min({gap, offset, cell_size_ - offset});
+    }
+
+    // rounding may put pt just outside its cell
+    return std::max(gap, 0.0);
+}
+
+template <class PointType>
+template <class Visit>
+void
+grid_index<PointType>::for_each_shell_row(const cell_type& center,
+                                          std::int64_t ring,
+                                          Visit& visit) const
+{
+    cell_type c;
+    shell_helper(c, 0ul, ring == 0, center, ring, visit);
+}
+
+template <class PointType>
+template <class Visit>
+void
+grid_index<PointType>::shell_helper(cell_type& c,
+                                    std::size_t dim,
+                                    bool on_shell,
+                                    const cell_type& center,
+                                    std::int64_t ring,
+                                    Visit& visit) const
+{
+    const std::int64_t first = std::max(low_[dim], center[dim] - ring);
+    const std::int64_t last = std::min(high_[dim], center[dim] + ring);
+
+    if(dim + 1ul < dimensions)
+    {
+        for(std::int64_t value = first; value <= last; ++value)
+        {
+            c[dim] = value;
+            shell_helper(c,
+                         dim + 1ul,
+                         on_shell || value == center[dim] - ring ||
+                             value == center[dim] + ring,
+                         center,
+                         ring,
+                         visit);
+        }
+    }
+    else if(on_shell)
+    {
+        visit_row(c, first, last, visit);
+    }
+    else if(first <= last)
+    {
+        // only the two faces of the shell are left
+        if(first == center[dim] - ring)
+        {
+            visit_row(c, first, first, visit);
+        }
+
+        if(last == center[dim] + ring)
+        {
+            visit_row(c, last, last, visit);
+        }
+    }
+}
+
+template <class PointType>
+template <class Visit>
+void
+grid_index<PointType>::visit_row(cell_type& c,
+                                 std::int64_t first,
+                                 std::int64_t last,
+                                 Visit& visit) const
+{
+    if(first > last)
+    {
+        return;
+    }
+
+    c[dimensions - 1ul] = first;
+    const size_type b = bucket(c);
+
+    if(!hashed_)
+    {
+        // consecutive cells of a row are consecutive buckets
+        visit(offsets_[b],
+              offsets_[b + static_cast<size_type>(last - first) + 1ul]);
+        return;
+    }
+
+    visit_marks& scratch = scratch_marks();
+    for(std::int64_t value = first; value <= last; ++value)
+    {
+        c[dimensions - 1ul] = value;
+        const size_type hashed = bucket(c);
+
+        if(scratch.marks[hashed] != scratch.stamp)
+        {
+            scratch.marks[hashed] = scratch.stamp;
+            visit(offsets_[hashed], offsets_[hashed + 1ul]);
+        }
+    }
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+grid_index<PointType>::k_nearest(const PointType& pt,
+                                 size_type k,
+                                 OutputIterator out,
+                                 Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Metric>
+void
+grid_index<PointType>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul || points_.empty())
+    {
+        return;
+    }
+
+    begin_visits();
+
+    auto visit = [&](size_type first, size_type last) {
+        for(size_type i = first; i < last; ++i)
+        {
+            heap.push(metric(pt, points_[i]), i);
+        }
+    };
+
+    const cell_type center = cell(pt);
+    const double gap = inner_gap(pt, center);
+
+    for(std::int64_t ring = first_ring(center);; ++ring)
+    {
+        if(scan_instead(center, ring))
+        {
+            visit_remaining(visit);
+            return;
+        }
+
+        for_each_shell_row(center, ring, visit);
+
+        if(covers(center, ring))
+        {
+            return;
+        }
+
+        // points not yet scanned lie outside the cube of cells within ring
+        const distance_type bound = metric.axis(static_cast<distance_type>(
+            static_cast<double>(ring) * cell_size_ + gap));
+        if(heap.full() && !(bound < heap.worst()))
+        {
+            return;
+        }
+    }
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+grid_index<PointType>::radius_query(const PointType& center,
+                                    distance_type r,
+                                    OutputIterator out,
+                                    Metric metric) const
+{
+    if(points_.empty())
+    {
+        return out;
+    }
+
+    begin_visits();
+
+    auto visit = [&](size_type first, size_type last) {
+        for(size_type i = first; i < last; ++i)
+        {
+            if(!(r < metric(center, points_[i])))
+            {
+                *out++ = points_[i];
+            }
+        }
+    };
+
+    const cell_type middle = cell(center);
+    const double gap = inner_gap(center, middle);
+
+    for(std::int64_t ring = first_ring(middle);; ++ring)
+    {
+        if(scan_instead(middle, ring))
+        {
+            visit_remaining(visit);
+            return out;
+        }
+
+        for_each_shell_row(middle, ring, visit);
+
+        // points not yet scanned lie outside the cube of cells within ring
+        const distance_type bound = metric.axis(static_cast<distance_type>(
+            static_cast<double>(ring) * cell_size_ + gap));
+        if(covers(middle, ring) || r < bound)
+        {
+            return out;
+        }
+    }
+}
+} // namespace multidim
+} // namespace useful
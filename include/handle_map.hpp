@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <utility>
+#include <cstddef>
+#include <thread>
+#include "parallel_for.hpp"
 
 
 namespace useful
@@ -20,6 +23,9 @@ public:
     typedef typename std::vector<T>::iterator iterator;
     typedef typename std::vector<T>::const_iterator const_iterator;
 
+    // elements per chunk of parallel_for_each_chunk
+    static constexpr std::size_t parallel_chunk = 4096;
+
 public:
     handle_type
     insert(const T& value)
@@ -91,7 +97,7 @@ public:
 
         // swap element to erase with back element
         std::swap(dense_[sparse_[n]], dense_.back());
-        std::swap(reverse_[n], reverse_[index_of_dense_back]);
+        std::swap(reverse_[sparse_[n]], reverse_[index_of_dense_back]);
 
         // update handle reference to new dense location
         sparse_[back_handle] = sparse_[n];
@@ -150,6 +156,44 @@ public:
         return dense_.cend();
     }
 
+    // Calls fn(n, values) with pointers to n consecutive elements of the
+    // dense storage, for chunks covering it, on up to threads threads. fn
+    // must be safe to call concurrently. The chunks start at multiples of
+    // parallel_chunk elements, independent of the number of threads. The
+    // dense storage is not cache line aligned, so neighbouring chunks may
+    // share a cache line at their boundary.
+    template <class Function>
+    void
+    parallel_for_each_chunk(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency())
+    {
+        T* values = dense_.data();
+        parallel_for(
+            dense_.size(),
+            parallel_chunk,
+            [&](std::size_t first, std::size_t last) {
+                fn(last - first, values + first);
+            },
+            threads);
+    }
+
+    template <class Function>
+    void
+    parallel_for_each_chunk(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        const T* values = dense_.data();
+        parallel_for(
+            dense_.size(),
+            parallel_chunk,
+            [&](std::size_t first, std::size_t last) {
+                fn(last - first, values + first);
+            },
+            threads);
+    }
+
 private:
     std::vector<T> dense_;
     std::vector<size_type> sparse_;
@@ -1,38 +1,902 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <utility>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <limits>
+#include <cmath>
+#include <iterator>
+#include <type_traits>
+#include <string>
+#include <fstream>
+#include <stdexcept>
 #include "point_traits.hpp"
+#include "space_filling_curve.hpp"
 
 
 namespace useful
 {
 namespace multidim
 {
+// Bounded max-heap keeping the k smallest (distance, index) pairs pushed to
+// it. Storage is kept between calls to reset so a heap can be reused for
+// many queries without allocating.
+template <class DistanceType, class IndexType>
+class neighbour_heap
+{
+public:
+    struct entry
+    {
+        DistanceType distance;
+        IndexType index;
+
+        bool
+        operator<(const entry& other) const
+        {
+            return distance < other.distance;
+        }
+    };
+
+    typedef typename std::vector<entry>::size_type size_type;
+    typedef typename std::vector<entry>::const_iterator const_iterator;
+
+public:
+    neighbour_heap() : capacity_(0ul)
+    {
+    }
+
+    void
+    reset(size_type k)
+    {
+        capacity_ = k;
+        entries_.clear();
+        entries_.reserve(k);
+    }
+
+    bool
+    full() const
+    {
+        return entries_.size() >= capacity_;
+    }
+
+    bool
+    empty() const
+    {
+        return entries_.empty();
+    }
+
+    size_type
+    size() const
+    {
+        return entries_.size();
+    }
+
+    // largest distance currently kept, only valid when not empty
+    DistanceType
+    worst() const
+    {
+        return entries_.front().distance;
+    }
+
+    void push(DistanceType distance, IndexType index);
+
+    // orders entries by ascending distance, after which the heap must be
+    // reset before pushing again
+    void
+    sort()
+    {
+        std::sort_heap(entries_.begin(), entries_.end());
+    }
+
+    const_iterator
+    begin() const
+    {
+        return entries_.cbegin();
+    }
+
+    const_iterator
+    end() const
+    {
+        return entries_.cend();
+    }
+
+private:
+    size_type capacity_;
+    std::vector<entry> entries_;
+};
+
+
+namespace kdtree_detail
+{
+template <class SizeType, class DistanceType>
+struct search_entry
+{
+    SizeType index;
+    SizeType level;
+    DistanceType bound;
+};
+
+template <class SizeType, class DistanceType>
+std::vector<search_entry<SizeType, DistanceType>>&
+search_stack()
+{
+    thread_local std::vector<search_entry<SizeType, DistanceType>> stack;
+    return stack;
+}
+
+template <class DistanceType, class SizeType>
+neighbour_heap<DistanceType, SizeType>&
+scratch_heap()
+{
+    thread_local neighbour_heap<DistanceType, SizeType> heap;
+    return heap;
+}
+
+
+template <class Topology, class Query, class SizeType>
+void
+scan_bucket(const Topology& topo, Query& query, SizeType first, SizeType n)
+{
+    for(SizeType index = first; index < first + n; ++index)
+    {
+        if(topo.live(index))
+        {
+            query.visit(topo.point(index));
+        }
+    }
+}
+
+
+// Branch-and-bound traversal shared by all trees and queries, starting at
+// node 0 of a non-empty tree.
+//
+// Topology supplies children(index) returning the indices of the smaller and
+// bigger subtrees, 0 meaning no subtree, split_dimension(index, level),
+// point(index) giving the position of the node's point in points,
+// live(index), which is false for nodes that only remain as split points, and
+// bucket(index), the number of nodes from index on that make up its whole
+// subtree when that is to be scanned as a leaf bucket and 0 otherwise.
+// Queries are handed point positions rather than node indices.
+//
+// Query supplies prune(bound) telling whether a subtree with the given lower
+// bound can be skipped, visit(index) for every node reached, and
+// bounds(node, dim, parent_bound) returning the lower bounds of the smaller
+// and bigger subtrees of node. Nearer subtrees are visited first.
+template <class PointType, class Topology, class Query>
+void
+search(const PointType* points, const Topology& topo, Query& query)
+{
+    typedef typename Query::size_type size_type;
+    typedef coordinate_type<PointType> distance_type;
+
+    std::vector<search_entry<size_type, distance_type>>& stack =
+        search_stack<size_type, distance_type>();
+    stack.clear();
+    stack.push_back({0ul, 0ul, distance_type()});
+
+    while(!stack.empty())
+    {
+        const search_entry<size_type, distance_type> current = stack.back();
+        stack.pop_back();
+
+        // bound may have been tightened since the entry was pushed
+        if(query.prune(current.bound))
+        {
+            continue;
+        }
+
+        const size_type bucket = topo.bucket(current.index);
+        if(bucket)
+        {
+            scan_bucket(topo, query, current.index, bucket);
+            continue;
+        }
+
+        if(topo.live(current.index))
+        {
+            query.visit(topo.point(current.index));
+        }
+
+        const std::pair<size_type, size_type> children =
+            topo.children(current.index);
+        const std::pair<distance_type, distance_type> bounds =
+            query.bounds(points[topo.point(current.index)],
+                         topo.split_dimension(current.index, current.level),
+                         current.bound);
+
+        const size_type next_level = current.level + 1ul;
+
+        // push the farther subtree first so the nearer one is popped first
+        if(bounds.first < bounds.second)
+        {
+            if(children.second && !query.prune(bounds.second))
+            {
+                stack.push_back({children.second, next_level, bounds.second});
+            }
+            if(children.first && !query.prune(bounds.first))
+            {
+                stack.push_back({children.first, next_level, bounds.first});
+            }
+        }
+        else
+        {
+            if(children.first && !query.prune(bounds.first))
+            {
+                stack.push_back({children.first, next_level, bounds.first});
+            }
+            if(children.second && !query.prune(bounds.second))
+            {
+                stack.push_back({children.second, next_level, bounds.second});
+            }
+        }
+    }
+}
+
+
+// Best-bin-first variant of search for approximate queries. Subtrees are
+// taken from a priority queue ordered by their lower bound; each is followed
+// down its nearer children to a leaf, queueing the farther ones. Stops once
+// max_visits nodes were visited or the best queued bound is pruned.
+template <class PointType, class Topology, class Query>
+void
+best_first_search(const PointType* points,
+                  const Topology& topo,
+                  Query& query,
+                  std::size_t max_visits)
+{
+    typedef typename Query::size_type size_type;
+    typedef coordinate_type<PointType> distance_type;
+    typedef search_entry<size_type, distance_type> entry;
+
+    const auto further = [](const entry& lhs, const entry& rhs) {
+        return rhs.bound < lhs.bound;
+    };
+
+    std::vector<entry>& queue = search_stack<size_type, distance_type>();
+    queue.clear();
+    queue.push_back({0ul, 0ul, distance_type()});
+
+    std::size_t visits = 0ul;
+
+    while(!queue.empty() && visits < max_visits)
+    {
+        std::pop_heap(queue.begin(), queue.end(), further);
+        entry current = queue.back();
+        queue.pop_back();
+
+        // every queued subtree is at least as far away
+        if(query.prune(current.bound))
+        {
+            return;
+        }
+
+        for(;;)
+        {
+            const size_type bucket = topo.bucket(current.index);
+            if(bucket)
+            {
+                scan_bucket(topo, query, current.index, bucket);
+                visits += bucket;
+
+                if(visits >= max_visits)
+                {
+                    return;
+                }
+
+                break;
+            }
+
+            if(topo.live(current.index))
+            {
+                query.visit(topo.point(current.index));
+            }
+
+            if(++visits >= max_visits)
+            {
+                return;
+            }
+
+            const std::pair<size_type, size_type> children =
+                topo.children(current.index);
+            const std::pair<distance_type, distance_type> bounds =
+                query.bounds(points[topo.point(current.index)],
+                             topo.split_dimension(current.index,
+                                                  current.level),
+                             current.bound);
+
+            entry smaller{children.first, current.level + 1ul, bounds.first};
+            entry bigger{children.second, current.level + 1ul, bounds.second};
+
+            entry& near = bounds.first < bounds.second ? smaller : bigger;
+            entry& far = bounds.first < bounds.second ? bigger : smaller;
+
+            if(far.index && !query.prune(far.bound))
+            {
+                queue.push_back(far);
+                std::push_heap(queue.begin(), queue.end(), further);
+            }
+
+            if(!near.index || query.prune(near.bound))
+            {
+                break;
+            }
+
+            current = near;
+        }
+    }
+}
+
+
+// lower bounds of the smaller and bigger subtrees of a node for queries
+// measuring distance from target
+template <class PointType, class Metric>
+std::pair<coordinate_type<PointType>, coordinate_type<PointType>>
+split_bounds(const PointType& target,
+             const PointType& node,
+             std::size_t dim,
+             coordinate_type<PointType> parent,
+             const Metric& metric)
+{
+    typedef coordinate_type<PointType> distance_type;
+
+    const distance_type value = coordinate(target, dim);
+    const distance_type split = coordinate(node, dim);
+    const distance_type far =
+        std::max(parent, metric.axis(absolute_difference(value, split)));
+
+    if(value < split)
+    {
+        return {parent, far};
+    }
+
+    return {far, parent};
+}
+
+
+template <class PointType, class Metric>
+struct nearest_query
+{
+    typedef std::size_t size_type;
+    typedef coordinate_type<PointType> distance_type;
+
+    bool
+    prune(distance_type bound) const
+    {
+        return heap.full() && !(bound < heap.worst());
+    }
+
+    void
+    visit(size_type index)
+    {
+        heap.push(metric(target, points[index]), index);
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(const PointType& node, std::size_t dim, distance_type parent) const
+    {
+        return split_bounds(target, node, dim, parent, metric);
+    }
+
+    const PointType* points;
+    const PointType& target;
+    Metric metric;
+    neighbour_heap<distance_type, size_type>& heap;
+};
+
+
+// nearest_query that also prunes subtrees that cannot improve the current
+// neighbours by more than a factor of 1 + eps
+template <class PointType, class Metric>
+struct approximate_nearest_query : nearest_query<PointType, Metric>
+{
+    typedef coordinate_type<PointType> distance_type;
+
+    bool
+    prune(distance_type bound) const
+    {
+        // in double, so a fractional scale also applies to integer
+        // coordinates
+        return this->heap.full() &&
+               !(static_cast<double>(bound) * scale <
+                 static_cast<double>(this->heap.worst()));
+    }
+
+    double scale;
+};
+
+
+template <class PointType, class OutputIterator>
+struct range_query
+{
+    typedef std::size_t size_type;
+    typedef coordinate_type<PointType> distance_type;
+
+    // bounds are 0 for subtrees overlapping the box and 1 otherwise
+    bool
+    prune(distance_type bound) const
+    {
+        return distance_type() < bound;
+    }
+
+    void
+    visit(size_type index)
+    {
+        const PointType& pt = points[index];
+        for(std::size_t dim = 0; dim < point_traits<PointType>::dimensions;
+            ++dim)
+        {
+            const distance_type value = coordinate(pt, dim);
+            if(value < coordinate(min_pt, dim) ||
+               coordinate(max_pt, dim) < value)
+            {
+                return;
+            }
+        }
+
+        *out++ = pt;
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(const PointType& node, std::size_t dim, distance_type) const
+    {
+        const distance_type split = coordinate(node, dim);
+
+        return {coordinate(min_pt, dim) <= split ? distance_type()
+                                                 : distance_type(1),
+                split <= coordinate(max_pt, dim) ? distance_type()
+                                                 : distance_type(1)};
+    }
+
+    const PointType* points;
+    const PointType& min_pt;
+    const PointType& max_pt;
+    OutputIterator out;
+};
+
+
+template <class PointType, class OutputIterator, class Metric>
+struct radius_query
+{
+    typedef std::size_t size_type;
+    typedef coordinate_type<PointType> distance_type;
+
+    bool
+    prune(distance_type bound) const
+    {
+        return radius < bound;
+    }
+
+    void
+    visit(size_type index)
+    {
+        const PointType& pt = points[index];
+        if(!(radius < metric(center, pt)))
+        {
+            *out++ = pt;
+        }
+    }
+
+    std::pair<distance_type, distance_type>
+    bounds(const PointType& node, std::size_t dim, distance_type parent) const
+    {
+        return split_bounds(center, node, dim, parent, metric);
+    }
+
+    const PointType* points;
+    const PointType& center;
+    distance_type radius;
+    Metric metric;
+    OutputIterator out;
+};
+
+
+// Runs tree.k_nearest for every query in [first, last) on up to threads
+// threads, each using its own scratch heap. The neighbours of the i-th query
+// are written to out[i * k], out[i * k + 1], ... closest first, so out needs
+// random access. Rows are left short when the tree holds fewer than k
+// points.
+template <class Tree,
+          class RandomAccessIterator,
+          class RandomAccessOutputIterator,
+          class Metric>
+void
+k_nearest_batch(const Tree& tree,
+                RandomAccessIterator first,
+                RandomAccessIterator last,
+                std::size_t k,
+                RandomAccessOutputIterator out,
+                unsigned threads,
+                bool spatial_order,
+                Metric metric)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+        point_type;
+    typedef coordinate_type<point_type> distance_type;
+
+    const std::size_t n = static_cast<std::size_t>(last - first);
+    if(n == 0ul)
+    {
+        return;
+    }
+
+    // visit queries along a Hilbert curve so consecutive queries touch the
+    // same parts of the tree
+    std::vector<std::size_t> order;
+    if(spatial_order)
+    {
+        order = curve_order(first, last, curve::hilbert);
+    }
+    else
+    {
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0ul);
+    }
+
+    auto run = [&](std::size_t begin, std::size_t end) {
+        neighbour_heap<distance_type, std::size_t>& heap =
+            scratch_heap<distance_type, std::size_t>();
+
+        for(std::size_t i = begin; i < end; ++i)
+        {
+            const std::size_t query = order[i];
+            tree.k_nearest(first[query], k, heap, metric);
+            heap.sort();
+
+            RandomAccessOutputIterator result = out + query * k;
+            for(const auto& neighbour : heap)
+            {
+                *result++ = tree.cbegin()[neighbour.index];
+            }
+        }
+    };
+
+    threads = static_cast<unsigned>(
+        std::max<std::size_t>(1ul, std::min<std::size_t>(threads, n)));
+    const std::size_t chunk = (n + threads - 1u) / threads;
+
+    std::vector<std::future<void>> workers;
+    for(std::size_t begin = chunk; begin < n; begin += chunk)
+    {
+        workers.push_back(std::async(
+            std::launch::async, run, begin, std::min(begin + chunk, n)));
+    }
+
+    run(0ul, std::min(chunk, n));
+
+    for(auto& worker : workers)
+    {
+        worker.get();
+    }
+}
+
+
+// Snapshots are the raw contents of a tree: this header, the points from
+// offset 64 and the records from the next multiple of 64 after them. They
+// are only readable on machines with the same byte order and ABI.
+struct snapshot_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t dimensions;
+    std::uint64_t point_size;
+    std::uint64_t record_size;
+    std::uint64_t size;
+    std::uint64_t erased;
+    char reserved[16];
+};
+
+static_assert(sizeof(snapshot_header) == 64, "unexpected padding");
+
+constexpr char snapshot_magic[8] = {'u', 's', 'e', 'f', 'k', 'd', 't', '\0'};
+constexpr std::uint32_t snapshot_version = 2u;
+constexpr std::uint64_t snapshot_alignment = 64u;
+
+inline std::uint64_t
+snapshot_records_offset(std::uint64_t size, std::uint64_t point_size)
+{
+    const std::uint64_t end = sizeof(snapshot_header) + size * point_size;
+    return (end + snapshot_alignment - 1u) / snapshot_alignment *
+           snapshot_alignment;
+}
+
+template <class PointType, class Record>
+snapshot_header
+make_snapshot_header(std::uint64_t size, std::uint64_t erased)
+{
+    snapshot_header out{};
+    std::copy(std::begin(snapshot_magic),
+              std::end(snapshot_magic),
+              std::begin(out.magic));
+    out.version = snapshot_version;
+    out.dimensions = point_traits<PointType>::dimensions;
+    out.point_size = sizeof(PointType);
+    out.record_size = sizeof(Record);
+    out.size = size;
+    out.erased = erased;
+
+    return out;
+}
+
+// throws std::runtime_error unless header describes a snapshot of
+// file_size bytes holding PointType points
+template <class PointType, class Record>
+void
+check_snapshot_header(const snapshot_header& header, std::uint64_t file_size)
+{
+    if(!std::equal(std::begin(snapshot_magic),
+                   std::end(snapshot_magic),
+                   std::begin(header.magic)))
+    {
+        throw std::runtime_error("not a kdtree snapshot");
+    }
+
+    if(header.version != snapshot_version)
+    {
+        throw std::runtime_error("unsupported kdtree snapshot version");
+    }
+
+    if(header.dimensions != point_traits<PointType>::dimensions ||
+       header.point_size != sizeof(PointType) ||
+       header.record_size != sizeof(Record))
+    {
+        throw std::runtime_error("kdtree snapshot of a different point type");
+    }
+
+    // dividing first keeps the sizes below from overflowing
+    if(header.size > file_size / (header.point_size + header.record_size) ||
+       file_size <
+           snapshot_records_offset(header.size, header.point_size) +
+               header.size * header.record_size)
+    {
+        throw std::runtime_error("truncated kdtree snapshot");
+    }
+
+    if(header.erased > header.size)
+    {
+        throw std::runtime_error("corrupt kdtree snapshot");
+    }
+}
+
+// Throws std::runtime_error unless the size records of a snapshot form one
+// tree rooted at 0, with every position in range, children linked back to
+// their parent and erased of them erased. Queries then only read within the
+// snapshot.
+template <class Record>
+void
+check_snapshot_records(const Record* records,
+                       std::uint64_t size,
+                       std::uint64_t erased,
+                       std::size_t dimensions)
+{
+    std::uint64_t reached = 0u;
+    std::uint64_t erased_reached = 0u;
+    std::vector<std::uint64_t> stack;
+    if(size > 0u)
+    {
+        stack.push_back(0u);
+    }
+
+    // a child is only followed from its parent, so no record is reached
+    // twice
+    while(!stack.empty())
+    {
+        const std::uint64_t index = stack.back();
+        stack.pop_back();
+
+        const Record& rec = records[index];
+        ++reached;
+        erased_reached += rec.erased;
+
+        if(rec.dim >= dimensions || rec.bucket > size - index ||
+           (rec.smaller && rec.smaller == rec.bigger))
+        {
+            throw std::runtime_error("corrupt kdtree snapshot");
+        }
+
+        for(const std::uint64_t child : {std::uint64_t(rec.smaller),
+                                         std::uint64_t(rec.bigger)})
+        {
+            if(!child)
+            {
+                continue;
+            }
+
+            if(child >= size || records[child].parent != index)
+            {
+                throw std::runtime_error("corrupt kdtree snapshot");
+            }
+
+            stack.push_back(child);
+        }
+    }
+
+    if(reached != size || erased_reached != erased)
+    {
+        throw std::runtime_error("corrupt kdtree snapshot");
+    }
+}
+
+
+// bits needed to tell apart the given number of values, at least 1
+constexpr std::size_t
+bits_for(std::size_t values)
+{
+    std::size_t out = 1ul;
+    while(out < std::numeric_limits<std::size_t>::digits &&
+          (std::size_t(1ul) << out) < values)
+    {
+        ++out;
+    }
+
+    return out;
+}
+} // namespace kdtree_detail
+
+
 template <class PointType>
+class mapped_kdtree;
+
+
+// Every point is a node of the tree. Building lays subtrees out in
+// contiguous runs; those of at most BucketSize points are then scanned
+// linearly by queries instead of being descended node by node. A run stops
+// being used as a bucket once an insert or erase breaks it up, until the
+// next rebuild of its subtree.
+//
+// Each node records the dimension it splits on. Building splits every
+// subtree on the dimension its points spread most in, inserted points cycle
+// through the dimensions starting after the one of their parent.
+template <class PointType, std::size_t BucketSize = 1>
 class kdtree
 {
+    static_assert(BucketSize >= 1 && BucketSize <= 255,
+                  "BucketSize must be in [1, 255]");
+
+    friend class mapped_kdtree<PointType>;
+
 public:
     typedef typename std::vector<PointType>::size_type size_type;
     typedef typename std::vector<PointType>::iterator unsorted_iterator;
     typedef
         typename std::vector<PointType>::const_iterator const_unsorted_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+private:
+    static constexpr std::size_t dimension_bits =
+        kdtree_detail::bits_for(point_traits<PointType>::dimensions);
+    // bits of a record left for the position of the parent
+    static constexpr std::size_t parent_bits =
+        std::numeric_limits<size_type>::digits - 9 - dimension_bits;
+
+    static_assert(9 + dimension_bits < std::numeric_limits<size_type>::digits,
+                  "too many dimensions to pack a record");
+
+    struct record
+    {
+        record() = default;
+        record(size_type small,
+               size_type big,
+               size_type par,
+               std::size_t split);
+
+        size_type smaller;
+        size_type bigger;
+        size_type parent : parent_bits;
+        size_type dim : dimension_bits;
+        // size of the subtree if it still occupies the slots from this one
+        // on and is small enough to be scanned as a leaf bucket, otherwise 0
+        size_type bucket : 8;
+        // erased points are kept as long as they split a subtree
+        size_type erased : 1;
+    };
+
+    // Points in the subtree of a record and how many of them are erased,
+    // kept beside the records so snapshots keep their layout.
+    struct subtree_count
+    {
+        size_type size;
+        size_type erased;
+    };
+
+
+    template <class Point>
+    void insert_helper(Point&& pt);
+
+    // appends pt in a new slot with the given parent, not yet linked into
+    // the tree; leaves the storage unchanged if that throws
+    template <class Point>
+    void push_slot(Point&& pt, size_type parent, std::size_t dim);
+
+    // median partitions points[first, last) on the dimension of largest
+    // spread, leaving the median at first followed by the smaller and the
+    // bigger subtrees, and returns first. Subtrees are built concurrently by
+    // up to threads threads.
+    static size_type build_helper(std::vector<PointType>& points,
+                                  std::vector<record>& records,
+                                  size_type first,
+                                  size_type last,
+                                  size_type parent,
+                                  unsigned threads);
 
-private:
-    struct record
+    // dimension with the largest difference between the smallest and the
+    // biggest coordinate in points[first, last)
+    static std::size_t spread_dimension(const std::vector<PointType>& points,
+                                        size_type first,
+                                        size_type last);
+
+    // recomputes the counts of the subtree at index from its records
+    void count_subtree(size_type index);
+
+    // removes size points, erased of them erased, from the counts of index
+    // and its ancestors
+    void uncount(size_type index, size_type size, size_type erased);
+
+    // rebuilds the subtree of the deepest ancestor of index that is out of
+    // balance, if index is deeper than the tree size allows
+    void rebalance(size_type index, size_type level);
+
+    // rebuilds the subtree at index into a balanced subtree of its live
+    // points, reusing its slots and releasing those no longer needed
+    void rebuild_subtree(size_type index);
+
+    // fills slot index with the last point and shrinks the storage by one,
+    // index must not be linked into the tree
+    void remove_slot(size_type index);
+
+    // clears the buckets index belongs to, before its subtree stops being
+    // contiguous
+    void split_buckets(size_type index);
+
+    struct topology
     {
-        record() = default;
-        record(size_type small, size_type big, size_type par);
+        std::pair<size_type, size_type>
+        children(size_type index) const
+        {
+            return {records[index].smaller, records[index].bigger};
+        }
 
-        size_type smaller;
-        size_type bigger;
-        size_type parent;
-    };
+        std::size_t
+        split_dimension(size_type index, size_type) const
+        {
+            return records[index].dim;
+        }
+
+        size_type
+        point(size_type index) const
+        {
+            return index;
+        }
+
+        bool
+        live(size_type index) const
+        {
+            return !records[index].erased;
+        }
 
+        size_type
+        bucket(size_type index) const
+        {
+            return records[index].bucket;
+        }
 
-    void insert_helper(const PointType& pt, size_type index, size_type level);
+        const record* records;
+    };
 
-    void insert_helper(PointType&& pt, size_type index, size_type level);
+    template <class Query>
+    void
+    search(Query& query) const
+    {
+        if(!dense_.empty())
+        {
+            kdtree_detail::search(
+                dense_.data(), topology{sparse_.data()}, query);
+        }
+    }
 
 
 public:
@@ -64,6 +928,7 @@ public:
             return &(ref_->dense_[current_]);
         }
 
+        // skips erased points
         depth_iterator& operator++();
 
         bool
@@ -81,6 +946,8 @@ public:
         }
 
     private:
+        void advance();
+
         size_type
         smaller() const
         {
@@ -104,227 +971,1206 @@ public:
         size_type current_;
     };
 
+public:
+    // subtrees smaller than this are always built by a single thread
+    static constexpr size_type parallel_build_threshold = 1ul << 14;
+
+    static constexpr std::size_t bucket_size = BucketSize;
+
+    // Largest number of points, erased ones included, whose positions fit a
+    // record. Inserting or building beyond it throws std::runtime_error.
+    static constexpr size_type
+    max_size()
+    {
+        return size_type(1) << parent_bits;
+    }
+
 public:
     kdtree() = default;
 
-    bool
-    empty() const
+    template <class InputIterator>
+    kdtree(InputIterator first, InputIterator last)
+    {
+        build(first, last);
+    }
+
+    template <class InputIterator>
+    kdtree(InputIterator first, InputIterator last, unsigned threads)
+    {
+        build(first, last, threads);
+    }
+
+    bool
+    empty() const
+    {
+        return dense_.empty();
+    }
+
+    // number of points not erased
+    size_type
+    size() const
+    {
+        return dense_.size() - erased_;
+    }
+
+    // length of the longest path from the root to a leaf, counted in nodes
+    size_type height() const;
+
+    // The unsorted range holds every point of the tree in storage order,
+    // including erased points that are still needed as split points until
+    // the next rebuild. Use erased(it) to tell them apart.
+
+    unsorted_iterator
+    begin()
+    {
+        return dense_.begin();
+    }
+
+    unsorted_iterator
+    end()
+    {
+        return dense_.end();
+    }
+
+    const_unsorted_iterator
+    cbegin() const
+    {
+        return dense_.cbegin();
+    }
+
+    const_unsorted_iterator
+    cend() const
+    {
+        return dense_.cend();
+    }
+
+    bool
+    erased(const_unsorted_iterator pos) const
+    {
+        return sparse_[pos - dense_.cbegin()].erased;
+    }
+
+    void
+    insert(const PointType& pt)
+    {
+        insert_helper(pt);
+    }
+
+    void
+    insert(PointType&& pt)
+    {
+        insert_helper(std::move(pt));
+    }
+
+    // Inserts every point in [first, last). An empty tree is bulk built
+    // instead, otherwise storage is grown once up front when the size of the
+    // range is known.
+    template <class InputIterator>
+    void insert(InputIterator first, InputIterator last);
+
+    // Removes the point at pos. Leaves are removed right away, other points
+    // are marked as erased and skipped by queries until enough of them
+    // accumulate in a subtree to trigger a rebuild of that subtree. Does
+    // nothing for points already erased. Invalidates all iterators.
+    void erase(const_unsorted_iterator pos);
+
+    // Writes a snapshot of the tree to path that can be read back with load
+    // or mapped into memory with mapped_kdtree. Throws std::runtime_error if
+    // the file cannot be written.
+    void save(const std::string& path) const;
+
+    // Replaces the contents of the tree with the snapshot at path. Throws
+    // std::runtime_error if it cannot be read, is truncated or corrupt, or
+    // was saved from a different point type.
+    void load(const std::string& path);
+
+    // rebuilds the whole tree into a balanced tree without erased points
+    void
+    rebuild()
+    {
+        if(!dense_.empty())
+        {
+            rebuild_subtree(0ul);
+        }
+    }
+
+    // Fraction of erased points in a subtree above which erase rebuilds the
+    // subtree, the highest one if several are above it. Defaults to 0.25.
+    void
+    max_erased_ratio(double ratio)
+    {
+        max_erased_ratio_ = ratio;
+    }
+
+    double
+    max_erased_ratio() const
+    {
+        return max_erased_ratio_;
+    }
+
+    // Scapegoat balance factor in [0.5, 1). A subtree is rebuilt by insert
+    // when one of its children holds more than this fraction of its nodes
+    // and the tree has grown deeper than log(size) / log(1 / alpha).
+    // Defaults to 0.75.
+    void
+    balance_factor(double alpha)
+    {
+        balance_factor_ = alpha;
+    }
+
+    double
+    balance_factor() const
+    {
+        return balance_factor_;
+    }
+
+    // Replaces the contents of the tree with a balanced tree of the points in
+    // [first, last). Nodes are laid out in depth first order so every
+    // subtree occupies a contiguous run of the unsorted range.
+    template <class InputIterator>
+    void
+    build(InputIterator first, InputIterator last)
+    {
+        build(first, last, 1u);
+    }
+
+    // Same as build(first, last) using up to threads threads. The resulting
+    // layout is identical to a single threaded build.
+    template <class InputIterator>
+    void build(InputIterator first, InputIterator last, unsigned threads);
+
+    // Returns an iterator to the point closest to pt, or cend() if the tree
+    // is empty.
+    template <class Metric = squared_euclidean>
+    const_unsorted_iterator nearest(const PointType& pt,
+                                    Metric metric = Metric()) const;
+
+    // Writes the k points closest to pt to out, closest first. Fewer than k
+    // points are written if the tree holds less than k points.
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    // Collects the k nearest neighbours of pt into heap as indices into the
+    // unsorted range, leaving the heap unsorted.
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    // Approximate k_nearest. Subtrees are searched nearest first and skipped
+    // unless they may hold a point more than 1 + eps times closer than the
+    // current k-th neighbour, with distances as measured by metric. At most
+    // max_visits nodes are visited. With squared_euclidean, eps = 0.21 gives
+    // neighbours within 1.1 times the true euclidean distance.
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator approximate_k_nearest(
+        const PointType& pt,
+        size_type k,
+        OutputIterator out,
+        double eps,
+        size_type max_visits = std::numeric_limits<size_type>::max(),
+        Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void approximate_k_nearest(
+        const PointType& pt,
+        size_type k,
+        neighbour_heap<distance_type, size_type>& heap,
+        double eps,
+        size_type max_visits = std::numeric_limits<size_type>::max(),
+        Metric metric = Metric()) const;
+
+    // Answers k_nearest for every point in [first, last) using up to threads
+    // threads. The neighbours of the i-th query are written to out[i * k],
+    // out[i * k + 1], ... closest first, so out must be a random access
+    // iterator to at least k * (last - first) elements. With fewer than k
+    // points in the tree, only the first size() elements of every row of k
+    // are written. With spatial_order set, queries are processed along a
+    // Hilbert curve to improve cache locality; the output layout is
+    // unaffected.
+    template <class RandomAccessIterator,
+              class RandomAccessOutputIterator,
+              class Metric = squared_euclidean>
+    void
+    k_nearest_batch(RandomAccessIterator first,
+                    RandomAccessIterator last,
+                    size_type k,
+                    RandomAccessOutputIterator out,
+                    unsigned threads = 1u,
+                    bool spatial_order = true,
+                    Metric metric = Metric()) const
+    {
+        kdtree_detail::k_nearest_batch(
+            *this, first, last, k, out, threads, spatial_order, metric);
+    }
+
+    // Writes every point p with min_pt <= p <= max_pt in all dimensions to
+    // out, in no particular order.
+    template <class OutputIterator>
+    OutputIterator range_query(const PointType& min_pt,
+                               const PointType& max_pt,
+                               OutputIterator out) const;
+
+    // Writes every point within distance r of center to out, in no particular
+    // order. r is measured by metric, so for the default squared_euclidean
+    // it is the squared radius.
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator radius_query(const PointType& center,
+                                distance_type r,
+                                OutputIterator out,
+                                Metric metric = Metric()) const;
+
+    depth_iterator
+    depth_begin()
+    {
+        if(sparse_.empty())
+        {
+            return depth_iterator({}, this, 0ul);
+        }
+        else
+        {
+            depth_iterator it(this, 0ul);
+            if(sparse_[0].erased)
+            {
+                ++it;
+            }
+
+            return it;
+        }
+    }
+
+    depth_iterator
+    depth_end()
+    {
+        return depth_iterator({}, this, 0ul);
+    }
+
+private:
+    std::vector<PointType> dense_;
+    std::vector<record> sparse_;
+    std::vector<subtree_count> counts_;
+    size_type erased_ = 0ul;
+    double max_erased_ratio_ = 0.25;
+    double balance_factor_ = 0.75;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class DistanceType, class IndexType>
+void
+neighbour_heap<DistanceType, IndexType>::push(DistanceType distance,
+                                              IndexType index)
+{
+    if(entries_.size() < capacity_)
+    {
+        entries_.push_back({distance, index});
+        std::push_heap(entries_.begin(), entries_.end());
+    }
+    else if(capacity_ && distance < entries_.front().distance)
+    {
+        std::pop_heap(entries_.begin(), entries_.end());
+        entries_.back() = {distance, index};
+        std::push_heap(entries_.begin(), entries_.end());
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+kdtree<PointType, BucketSize>::record::record(size_type small,
+                                              size_type big,
+                                              size_type par,
+                                              std::size_t split)
+    : smaller(small),
+      bigger(big),
+      parent(par),
+      dim(split),
+      bucket(0ul),
+      erased(0ul)
+{
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Point>
+void
+kdtree<PointType, BucketSize>::insert_helper(Point&& pt)
+{
+    if(dense_.size() == max_size())
+    {
+        throw std::runtime_error("kdtree: too many points");
+    }
+
+    if(dense_.empty())
+    {
+        push_slot(std::forward<Point>(pt), 0ul, 0ul);
+        return;
+    }
+
+    // descend to the empty child slot the point belongs in
+    size_type index = 0ul;
+    size_type level = 0ul;
+    bool smaller = false;
+
+    for(;;)
+    {
+        const record& current = sparse_[index];
+        smaller = less(pt, dense_[index], current.dim);
+        ++level;
+
+        const size_type child = smaller ? current.smaller : current.bigger;
+        if(!child)
+        {
+            break;
+        }
+
+        index = child;
+    }
+
+    const std::size_t dim =
+        (sparse_[index].dim + 1ul) % point_traits<PointType>::dimensions;
+
+    // store the point before linking it, so a throw leaves the tree as is
+    push_slot(std::forward<Point>(pt), index, dim);
+    const size_type slot = dense_.size() - 1ul;
+
+    record& parent = sparse_[index];
+    (smaller ? parent.smaller : parent.bigger) = slot;
+
+    for(;; index = sparse_[index].parent)
+    {
+        sparse_[index].bucket = 0ul;
+        ++counts_[index].size;
+
+        if(index == 0ul)
+        {
+            break;
+        }
+    }
+
+    rebalance(slot, level);
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Point>
+void
+kdtree<PointType, BucketSize>::push_slot(Point&& pt,
+                                         size_type parent,
+                                         std::size_t dim)
+{
+    dense_.push_back(std::forward<Point>(pt));
+
+    try
+    {
+        sparse_.emplace_back(0ul, 0ul, parent, dim);
+        counts_.push_back({1ul, 0ul});
+    }
+    catch(...)
+    {
+        if(sparse_.size() == dense_.size())
+        {
+            sparse_.pop_back();
+        }
+        dense_.pop_back();
+        throw;
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class InputIterator>
+void
+kdtree<PointType, BucketSize>::insert(InputIterator first, InputIterator last)
+{
+    if(dense_.empty())
+    {
+        build(first, last);
+        return;
+    }
+
+    typedef typename std::iterator_traits<InputIterator>::iterator_category
+        category;
+
+    if constexpr(std::is_base_of<std::forward_iterator_tag, category>::value)
+    {
+        const auto n = static_cast<size_type>(std::distance(first, last));
+        dense_.reserve(dense_.size() + n);
+        sparse_.reserve(sparse_.size() + n);
+        counts_.reserve(counts_.size() + n);
+    }
+
+    for(; first != last; ++first)
+    {
+        insert_helper(*first);
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class InputIterator>
+void
+kdtree<PointType, BucketSize>::build(InputIterator first,
+                                     InputIterator last,
+                                     unsigned threads)
+{
+    std::vector<PointType> points(first, last);
+    if(points.size() > max_size())
+    {
+        throw std::runtime_error("kdtree: too many points");
+    }
+
+    dense_.swap(points);
+    sparse_.assign(dense_.size(), record(0ul, 0ul, 0ul, 0ul));
+    counts_.resize(dense_.size());
+    erased_ = 0ul;
+
+    if(!dense_.empty())
+    {
+        build_helper(dense_,
+                     sparse_,
+                     0ul,
+                     dense_.size(),
+                     0ul,
+                     std::max(threads, 1u));
+        count_subtree(0ul);
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+typename kdtree<PointType, BucketSize>::size_type
+kdtree<PointType, BucketSize>::build_helper(std::vector<PointType>& points,
+                                            std::vector<record>& records,
+                                            size_type first,
+                                            size_type last,
+                                            size_type parent,
+                                            unsigned threads)
+{
+    const std::size_t dim = spread_dimension(points, first, last);
+    const size_type median = first + (last - first) / 2ul;
+
+    std::nth_element(points.begin() + first,
+                     points.begin() + median,
+                     points.begin() + last,
+                     [dim](const PointType& lhs, const PointType& rhs) {
+                         return less(lhs, rhs, dim);
+                     });
+
+    // element previously at first is not bigger than the median, so moving
+    // it to the median's slot keeps [first + 1, median + 1) the smaller half
+    std::swap(points[first], points[median]);
+
+    record& rec = records[first];
+    rec.parent = parent;
+    rec.dim = dim;
+
+    if(BucketSize > 1ul && last - first <= BucketSize)
+    {
+        rec.bucket = last - first;
+    }
+
+    const bool has_smaller = first + 1ul < median + 1ul;
+    const bool has_bigger = median + 1ul < last;
+
+    if(threads > 1u && has_smaller && has_bigger &&
+       last - first >= parallel_build_threshold)
+    {
+        // subtrees occupy disjoint runs of points and records
+        const unsigned bigger_threads = threads / 2u;
+        auto bigger = std::async(std::launch::async, [=, &points, &records] {
+            return build_helper(points,
+                                records,
+                                median + 1ul,
+                                last,
+                                first,
+                                bigger_threads);
+        });
+
+        rec.smaller = build_helper(points,
+                                   records,
+                                   first + 1ul,
+                                   median + 1ul,
+                                   first,
+                                   threads - bigger_threads);
+        rec.bigger = bigger.get();
+
+        return first;
+    }
+
+    if(has_smaller)
     {
-        return dense_.empty();
+        rec.smaller = build_helper(
+            points, records, first + 1ul, median + 1ul, first, 1u);
     }
 
-    size_type
-    size() const
+    if(has_bigger)
     {
-        return dense_.size();
+        rec.bigger =
+            build_helper(points, records, median + 1ul, last, first, 1u);
     }
 
-    unsorted_iterator
-    begin()
+    return first;
+}
+
+template <class PointType, std::size_t BucketSize>
+std::size_t
+kdtree<PointType, BucketSize>::spread_dimension(
+    const std::vector<PointType>& points, size_type first, size_type last)
+{
+    constexpr std::size_t dims = point_traits<PointType>::dimensions;
+
+    std::array<distance_type, dims> low;
+    std::array<distance_type, dims> high;
+
+    for(std::size_t dim = 0ul; dim < dims; ++dim)
     {
-        return dense_.begin();
+        low[dim] = high[dim] = coordinate(points[first], dim);
     }
 
-    unsorted_iterator
-    end()
+    for(size_type i = first + 1ul; i < last; ++i)
     {
-        return dense_.end();
+        for(std::size_t dim = 0ul; dim < dims; ++dim)
+        {
+            const distance_type value = coordinate(points[i], dim);
+            low[dim] = std::min(low[dim], value);
+            high[dim] = std::max(high[dim], value);
+        }
     }
 
-    const_unsorted_iterator
-    cbegin() const
+    std::size_t out = 0ul;
+    for(std::size_t dim = 1ul; dim < dims; ++dim)
     {
-        return dense_.cbegin();
+        if(high[out] - low[out] < high[dim] - low[dim])
+        {
+            out = dim;
+        }
     }
 
-    const_unsorted_iterator
-    cend() const
+    return out;
+}
+
+template <class PointType, std::size_t BucketSize>
+typename kdtree<PointType, BucketSize>::size_type
+kdtree<PointType, BucketSize>::height() const
+{
+    if(dense_.empty())
     {
-        return dense_.cend();
+        return 0ul;
     }
 
-    void
-    insert(const PointType& pt)
+    size_type out = 0ul;
+    std::vector<std::pair<size_type, size_type>> stack{{0ul, 1ul}};
+
+    while(!stack.empty())
     {
-        if(dense_.empty())
+        const std::pair<size_type, size_type> current = stack.back();
+        stack.pop_back();
+
+        out = std::max(out, current.second);
+
+        const record& rec = sparse_[current.first];
+        if(rec.smaller)
         {
-            dense_.push_back(pt);
-            sparse_.emplace_back(0ul, 0ul, 0ul);
+            stack.emplace_back(rec.smaller, current.second + 1ul);
         }
-        else
+        if(rec.bigger)
         {
-            insert_helper(pt, 0ul, 0ul);
+            stack.emplace_back(rec.bigger, current.second + 1ul);
         }
     }
 
-    void
-    insert(PointType&& pt)
+    return out;
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::count_subtree(size_type index)
+{
+    // breadth first, so children come after their parent
+    std::vector<size_type> order{index};
+    for(size_type i = 0; i < order.size(); ++i)
     {
-        if(dense_.empty())
+        const record& rec = sparse_[order[i]];
+        if(rec.smaller)
         {
-            dense_.push_back(std::move(pt));
-            sparse_.emplace_back(0ul, 0ul, 0ul);
+            order.push_back(rec.smaller);
         }
-        else
+        if(rec.bigger)
         {
-            insert_helper(std::move(pt), 0ul, 0ul);
+            order.push_back(rec.bigger);
         }
     }
 
-    depth_iterator
-    depth_begin()
+    for(auto it = order.rbegin(); it != order.rend(); ++it)
     {
-        if(sparse_.empty())
+        const record& rec = sparse_[*it];
+        subtree_count count{1ul, rec.erased};
+
+        for(const size_type child : {rec.smaller, rec.bigger})
         {
-            return depth_iterator({}, this, 0ul);
+            if(child)
+            {
+                count.size += counts_[child].size;
+                count.erased += counts_[child].erased;
+            }
         }
-        else
+
+        counts_[*it] = count;
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::uncount(size_type index,
+                                       size_type size,
+                                       size_type erased)
+{
+    for(;; index = sparse_[index].parent)
+    {
+        counts_[index].size -= size;
+        counts_[index].erased -= erased;
+
+        if(index == 0ul)
         {
-            return depth_iterator(this, 0ul);
+            return;
         }
     }
+}
 
-    depth_iterator
-    depth_end()
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::rebalance(size_type index, size_type level)
+{
+    const double limit = std::log(static_cast<double>(dense_.size())) /
+                         std::log(1.0 / balance_factor_);
+
+    if(static_cast<double>(level) <= limit)
     {
-        return depth_iterator({}, this, 0ul);
+        return;
     }
 
-private:
-    std::vector<PointType> dense_;
-    std::vector<record> sparse_;
-};
-} // namespace multidim
-} // namespace useful
+    // walk towards the root until a child holds too large a share of its
+    // parent's subtree, the scapegoat
+    for(size_type child = index; child != 0ul;)
+    {
+        const size_type parent = sparse_[child].parent;
 
+        if(static_cast<double>(counts_[child].size) >
+           balance_factor_ * static_cast<double>(counts_[parent].size))
+        {
+            rebuild_subtree(parent);
+            return;
+        }
 
-namespace useful
-{
-namespace multidim
-{
-template <class PointType>
-kdtree<PointType>::record::record(size_type small, size_type big, size_type par)
-    : smaller(small), bigger(big), parent(par)
-{
+        child = parent;
+    }
 }
 
-template <class PointType>
+template <class PointType, std::size_t BucketSize>
 void
-kdtree<PointType>::insert_helper(const PointType& pt,
-                                 size_type index,
-                                 size_type level)
+kdtree<PointType, BucketSize>::rebuild_subtree(size_type index)
 {
-    if(level >= point_traits<PointType>::dimensions)
+    const size_type parent = sparse_[index].parent;
+    // gather slots and live points of the subtree
+    std::vector<size_type> slots;
+    std::vector<PointType> points;
+    std::vector<size_type> stack{index};
+
+    while(!stack.empty())
     {
-        level = 0ul;
+        const size_type current = stack.back();
+        stack.pop_back();
+        slots.push_back(current);
+
+        const record& rec = sparse_[current];
+        if(rec.erased)
+        {
+            --erased_;
+        }
+        else
+        {
+            points.push_back(std::move(dense_[current]));
+        }
+
+        if(rec.smaller)
+        {
+            stack.push_back(rec.smaller);
+        }
+        if(rec.bigger)
+        {
+            stack.push_back(rec.bigger);
+        }
     }
-    else
+
+    if(points.empty() && index == 0ul)
     {
-        ++level;
+        dense_.clear();
+        sparse_.clear();
+        counts_.clear();
+        erased_ = 0ul;
+        return;
     }
 
-    const record& current = sparse_[index];
+    // the subtree root takes the lowest slot, so the root of the whole tree
+    // stays at 0
+    std::sort(slots.begin(), slots.end());
+    const size_type root = points.empty() ? 0ul : slots.front();
 
-    if(less(pt, dense_[index], level))
+    if(index != 0ul)
     {
-        if(current.smaller)
+        record& rec = sparse_[parent];
+        (rec.smaller == index ? rec.smaller : rec.bigger) = root;
+
+        // the released slots held the erased points
+        const size_type released = slots.size() - points.size();
+        uncount(parent, released, released);
+
+        // the buckets of the ancestors cover the released slots, which
+        // other points move into
+        if(released)
         {
-            // recurse
-            insert_helper(pt, current.smaller, level);
+            split_buckets(parent);
         }
-        else
+    }
+
+    if(!points.empty())
+    {
+        std::vector<record> records(points.size(),
+                                    record(0ul, 0ul, 0ul, 0ul));
+        build_helper(points, records, 0ul, points.size(), 0ul, 1u);
+
+        for(size_type i = 0; i < points.size(); ++i)
         {
-            dense_.push_back(pt);
-            const size_type new_index = dense_.size() - 1;
-            sparse_[index].smaller = new_index;
-            sparse_.emplace_back(0ul, 0ul, index);
+            const record& rec = records[i];
+
+            dense_[slots[i]] = std::move(points[i]);
+            sparse_[slots[i]] =
+                record(rec.smaller ? slots[rec.smaller] : 0ul,
+                       rec.bigger ? slots[rec.bigger] : 0ul,
+                       i == 0ul ? parent : slots[rec.parent],
+                       rec.dim);
+
+            // a bucket must still be contiguous after mapping it to slots
+            if(rec.bucket &&
+               slots[i + rec.bucket - 1ul] - slots[i] == rec.bucket - 1ul)
+            {
+                sparse_[slots[i]].bucket = rec.bucket;
+            }
         }
+
+        count_subtree(root);
     }
-    else
+
+    // release the remaining slots from the highest down, so the point moved
+    // into a released slot is never one that is released later
+    for(size_type i = slots.size(); i > points.size(); --i)
+    {
+        remove_slot(slots[i - 1ul]);
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::remove_slot(size_type index)
+{
+    const size_type last = dense_.size() - 1ul;
+
+    if(index != last)
     {
-        if(current.bigger)
+        split_buckets(last);
+
+        dense_[index] = std::move(dense_[last]);
+        sparse_[index] = sparse_[last];
+        counts_[index] = counts_[last];
+
+        const record& moved = sparse_[index];
+        record& parent = sparse_[moved.parent];
+
+        if(parent.smaller == last)
         {
-            insert_helper(pt, current.bigger, level);
+            parent.smaller = index;
         }
-        else
+        else if(parent.bigger == last)
+        {
+            parent.bigger = index;
+        }
+
+        if(moved.smaller)
+        {
+            sparse_[moved.smaller].parent = index;
+        }
+        if(moved.bigger)
         {
-            dense_.push_back(pt);
-            const size_type new_index = dense_.size() - 1;
-            sparse_[index].bigger = new_index;
-            sparse_.emplace_back(0ul, 0ul, index);
+            sparse_[moved.bigger].parent = index;
         }
     }
+
+    dense_.pop_back();
+    sparse_.pop_back();
+    counts_.pop_back();
 }
 
-template <class PointType>
+template <class PointType, std::size_t BucketSize>
 void
-kdtree<PointType>::insert_helper(PointType&& pt,
-                                 size_type index,
-                                 size_type level)
+kdtree<PointType, BucketSize>::split_buckets(size_type index)
 {
-    if(level >= point_traits<PointType>::dimensions)
+    for(;; index = sparse_[index].parent)
     {
-        level = 0ul;
+        sparse_[index].bucket = 0ul;
+
+        if(index == 0ul)
+        {
+            return;
+        }
     }
-    else
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::erase(const_unsorted_iterator pos)
+{
+    size_type index = static_cast<size_type>(pos - dense_.cbegin());
+
+    if(sparse_[index].erased)
     {
-        ++level;
+        return;
     }
 
-    const record& current = sparse_[index];
-
-    if(less(pt, dense_[index], level))
+    if(sparse_[index].smaller || sparse_[index].bigger)
     {
-        if(current.smaller)
+        sparse_[index].erased = 1ul;
+        ++erased_;
+
+        // the highest subtree with too many erased points, the scapegoat
+        bool rebuild = false;
+        size_type scapegoat = 0ul;
+
+        for(size_type current = index;; current = sparse_[current].parent)
         {
-            // recurse
-            insert_helper(std::move(pt), current.smaller, level);
+            subtree_count& count = counts_[current];
+            ++count.erased;
+
+            if(static_cast<double>(count.erased) >
+               max_erased_ratio_ * static_cast<double>(count.size))
+            {
+                rebuild = true;
+                scapegoat = current;
+            }
+
+            if(current == 0ul)
+            {
+                break;
+            }
         }
-        else
+
+        if(rebuild)
         {
-            dense_.push_back(std::move(pt));
-            const size_type new_index = dense_.size() - 1;
-            sparse_[index].smaller = new_index;
-            sparse_.emplace_back(0ul, 0ul, index);
+            rebuild_subtree(scapegoat);
         }
+
+        return;
     }
-    else
+
+    split_buckets(index);
+
+    // unlink the leaf along with erased ancestors it leaves childless
+    for(;;)
     {
-        if(current.bigger)
+        if(index == 0ul)
         {
-            insert_helper(std::move(pt), current.bigger, level);
+            dense_.clear();
+            sparse_.clear();
+            counts_.clear();
+            erased_ = 0ul;
+            return;
         }
-        else
+
+        const size_type parent = sparse_[index].parent;
+        const size_type last = dense_.size() - 1ul;
+
+        record& rec = sparse_[parent];
+        (rec.smaller == index ? rec.smaller : rec.bigger) = 0ul;
+        uncount(parent, 1ul, sparse_[index].erased);
+
+        remove_slot(index);
+
+        // parent is moved into index if it was the last point
+        index = parent == last ? index : parent;
+
+        const record& next = sparse_[index];
+        if(!next.erased || next.smaller || next.bigger)
         {
-            dense_.push_back(std::move(pt));
-            const size_type new_index = dense_.size() - 1;
-            sparse_[index].bigger = new_index;
-            sparse_.emplace_back(0ul, 0ul, index);
+            return;
         }
+
+        --erased_;
     }
 }
 
-template <class PointType>
-kdtree<PointType>::depth_iterator::depth_iterator(kdtree* ref,
-                                                  size_type current)
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::save(const std::string& path) const
+{
+    static_assert(std::is_trivially_copyable<PointType>::value,
+                  "snapshots require trivially copyable points");
+
+    const kdtree_detail::snapshot_header header =
+        kdtree_detail::make_snapshot_header<PointType, record>(dense_.size(),
+                                                               erased_);
+    const std::uint64_t points_end =
+        sizeof(header) + dense_.size() * sizeof(PointType);
+    const std::vector<char> padding(
+        kdtree_detail::snapshot_records_offset(dense_.size(),
+                                               sizeof(PointType)) -
+            points_end,
+        '\0');
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(dense_.data()),
+              dense_.size() * sizeof(PointType));
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char*>(sparse_.data()),
+              sparse_.size() * sizeof(record));
+
+    if(!out)
+    {
+        throw std::runtime_error("could not write kdtree snapshot " + path);
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::load(const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<PointType>::value,
+                  "snapshots require trivially copyable points");
+
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if(!in)
+    {
+        throw std::runtime_error("could not open kdtree snapshot " + path);
+    }
+
+    const std::uint64_t file_size = static_cast<std::uint64_t>(in.tellg());
+    in.seekg(0);
+
+    kdtree_detail::snapshot_header header;
+    if(!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        throw std::runtime_error("truncated kdtree snapshot");
+    }
+
+    kdtree_detail::check_snapshot_header<PointType, record>(header, file_size);
+
+    if(header.size > max_size())
+    {
+        throw std::runtime_error("kdtree snapshot too large");
+    }
+
+    std::vector<PointType> points(header.size);
+    std::vector<record> records(header.size);
+
+    in.read(reinterpret_cast<char*>(points.data()),
+            points.size() * sizeof(PointType));
+    in.seekg(kdtree_detail::snapshot_records_offset(header.size,
+                                                    sizeof(PointType)));
+    in.read(reinterpret_cast<char*>(records.data()),
+            records.size() * sizeof(record));
+
+    if(!in)
+    {
+        throw std::runtime_error("could not read kdtree snapshot " + path);
+    }
+
+    kdtree_detail::check_snapshot_records(records.data(),
+                                          header.size,
+                                          header.erased,
+                                          point_traits<PointType>::dimensions);
+
+    dense_.swap(points);
+    sparse_.swap(records);
+    erased_ = header.erased;
+
+    counts_.resize(dense_.size());
+    if(!dense_.empty())
+    {
+        count_subtree(0ul);
+    }
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+typename kdtree<PointType, BucketSize>::const_unsorted_iterator
+kdtree<PointType, BucketSize>::nearest(const PointType& pt, Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, 1ul, heap, metric);
+
+    if(heap.empty())
+    {
+        return dense_.cend();
+    }
+
+    return dense_.cbegin() + heap.begin()->index;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+OutputIterator
+kdtree<PointType, BucketSize>::k_nearest(const PointType& pt,
+                                         size_type k,
+                                         OutputIterator out,
+                                         Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = dense_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+void
+kdtree<PointType, BucketSize>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul)
+    {
+        return;
+    }
+
+    kdtree_detail::nearest_query<PointType, Metric> query{
+        dense_.data(), pt, metric, heap};
+    search(query);
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+OutputIterator
+kdtree<PointType, BucketSize>::approximate_k_nearest(const PointType& pt,
+                                                     size_type k,
+                                                     OutputIterator out,
+                                                     double eps,
+                                                     size_type max_visits,
+                                                     Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    approximate_k_nearest(pt, k, heap, eps, max_visits, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = dense_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class Metric>
+void
+kdtree<PointType, BucketSize>::approximate_k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    double eps,
+    size_type max_visits,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul || dense_.empty())
+    {
+        return;
+    }
+
+    kdtree_detail::approximate_nearest_query<PointType, Metric> query{
+        {dense_.data(), pt, metric, heap}, 1.0 + eps};
+    kdtree_detail::best_first_search(
+        dense_.data(), topology{sparse_.data()}, query, max_visits);
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator>
+OutputIterator
+kdtree<PointType, BucketSize>::range_query(const PointType& min_pt,
+                                           const PointType& max_pt,
+                                           OutputIterator out) const
+{
+    kdtree_detail::range_query<PointType, OutputIterator> query{
+        dense_.data(), min_pt, max_pt, out};
+    search(query);
+
+    return query.out;
+}
+
+template <class PointType, std::size_t BucketSize>
+template <class OutputIterator, class Metric>
+OutputIterator
+kdtree<PointType, BucketSize>::radius_query(const PointType& center,
+                                            distance_type r,
+                                            OutputIterator out,
+                                            Metric metric) const
+{
+    kdtree_detail::radius_query<PointType, OutputIterator, Metric> query{
+        dense_.data(), center, r, metric, out};
+    search(query);
+
+    return query.out;
+}
+
+template <class PointType, std::size_t BucketSize>
+kdtree<PointType, BucketSize>::depth_iterator::depth_iterator(
+    kdtree* ref, size_type current)
     : depth_stack_{state::unvisited}, ref_(ref), current_(current)
 {
 }
 
-template <class PointType>
-kdtree<PointType>::depth_iterator::depth_iterator(
+template <class PointType, std::size_t BucketSize>
+kdtree<PointType, BucketSize>::depth_iterator::depth_iterator(
     const std::vector<state>& depth_stack, kdtree* ref, size_type current)
     : depth_stack_(depth_stack), ref_(ref), current_(current)
 {
 }
 
-template <class PointType>
-typename kdtree<PointType>::depth_iterator&
-kdtree<PointType>::depth_iterator::operator++()
+template <class PointType, std::size_t BucketSize>
+typename kdtree<PointType, BucketSize>::depth_iterator&
+kdtree<PointType, BucketSize>::depth_iterator::operator++()
+{
+    do
+    {
+        advance();
+    } while(!depth_stack_.empty() && ref_->sparse_[current_].erased);
+
+    return *this;
+}
+
+template <class PointType, std::size_t BucketSize>
+void
+kdtree<PointType, BucketSize>::depth_iterator::advance()
 {
     if(depth_stack_.empty())
     {
-        return *this;
+        return;
     }
     else
     {
@@ -337,12 +2183,12 @@ kdtree<PointType>::depth_iterator::operator++()
                 current_ = smaller();
                 depth_stack_.push_back(state::unvisited);
 
-                return *this;
+                return;
             }
             else
             {
                 depth_stack_.back() = state::smaller_visited;
-                return operator++();
+                return advance();
             }
         }
         else if(node_state == state::smaller_visited)
@@ -353,13 +2199,13 @@ kdtree<PointType>::depth_iterator::operator++()
                 depth_stack_.push_back(state::unvisited);
                 current_ = bigger();
 
-                return *this;
+                return;
             }
             else
             {
                 depth_stack_.pop_back();
                 current_ = parent();
-                return operator++();
+                return advance();
             }
         }
         else if(node_state == state::visited)
@@ -367,11 +2213,9 @@ kdtree<PointType>::depth_iterator::operator++()
             depth_stack_.pop_back();
             current_ = parent();
 
-            return operator++();
+            return advance();
         }
     }
-
-    return *this;
 }
 
 } // namespace multidim
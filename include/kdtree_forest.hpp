@@ -0,0 +1,463 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include "point_traits.hpp"
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// Randomized kdtrees for approximate search in many dimensions. A single
+// copy of the points is shared by all trees; each tree only stores a node per
+// point holding its position in the shared points. At every node a tree
+// splits on a dimension picked at random among the few with the highest
+// variance, so the trees partition the space differently and a search
+// spreading its visits over all of them, with one candidate heap, misses far
+// fewer neighbours than a single tree given the same budget.
+template <class PointType>
+class kdtree_forest
+{
+public:
+    typedef typename std::vector<PointType>::size_type size_type;
+    typedef typename std::vector<PointType>::const_iterator const_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+    // split dimensions are drawn from this many highest variance dimensions
+    static constexpr std::size_t candidate_dimensions = 5ul;
+    // points sampled per node to estimate variances
+    static constexpr size_type variance_samples = 100ul;
+
+private:
+    // Nodes are laid out in pre-order, so the root is at 0 and a child index
+    // of 0 means no child.
+    struct node
+    {
+        size_type point;
+        size_type smaller;
+        size_type bigger;
+        std::size_t dim;
+    };
+
+    struct topology
+    {
+        std::pair<size_type, size_type>
+        children(size_type index) const
+        {
+            return {nodes[index].smaller, nodes[index].bigger};
+        }
+
+        std::size_t
+        split_dimension(size_type index, size_type) const
+        {
+            return nodes[index].dim;
+        }
+
+        size_type
+        point(size_type index) const
+        {
+            return nodes[index].point;
+        }
+
+        bool
+        live(size_type) const
+        {
+            return true;
+        }
+
+        size_type
+        bucket(size_type) const
+        {
+            return 0ul;
+        }
+
+        const node* nodes;
+    };
+
+    // Marks the points already pushed to the heap so that a point reached
+    // through several trees is only counted once.
+    struct visit_marks
+    {
+        std::vector<std::uint32_t> marks;
+        std::uint32_t stamp = 0u;
+    };
+
+    static visit_marks& scratch_marks();
+
+    template <class Metric>
+    struct forest_query
+    {
+        typedef std::size_t size_type;
+
+        bool
+        prune(distance_type bound) const
+        {
+            return inner.prune(bound);
+        }
+
+        void
+        visit(size_type index)
+        {
+            if(marks[index] != stamp)
+            {
+                marks[index] = stamp;
+                inner.visit(index);
+            }
+        }
+
+        std::pair<distance_type, distance_type>
+        bounds(const PointType& node,
+               std::size_t dim,
+               distance_type parent) const
+        {
+            return inner.bounds(node, dim, parent);
+        }
+
+        kdtree_detail::approximate_nearest_query<PointType, Metric> inner;
+        std::uint32_t* marks;
+        std::uint32_t stamp;
+    };
+
+    std::size_t choose_dimension(const size_type* first,
+                                 const size_type* last,
+                                 std::mt19937& random) const;
+
+    size_type build_helper(std::vector<node>& nodes,
+                           size_type* order,
+                           size_type first,
+                           size_type last,
+                           std::mt19937& random) const;
+
+public:
+    kdtree_forest() = default;
+
+    // Builds the given number of randomized trees over [first, last). Equal
+    // seeds give equal forests.
+    template <class InputIterator>
+    kdtree_forest(InputIterator first,
+                  InputIterator last,
+                  std::size_t trees = 4ul,
+                  std::uint32_t seed = 0u);
+
+    bool
+    empty() const
+    {
+        return points_.empty();
+    }
+
+    size_type
+    size() const
+    {
+        return points_.size();
+    }
+
+    std::size_t
+    trees() const
+    {
+        return trees_.size();
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    cend() const
+    {
+        return points_.cend();
+    }
+
+    // exact search, which only needs a single tree
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    // As kdtree::approximate_k_nearest, with max_visits shared evenly by the
+    // trees, each searched best bin first into the same heap.
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator approximate_k_nearest(
+        const PointType& pt,
+        size_type k,
+        OutputIterator out,
+        double eps,
+        size_type max_visits = std::numeric_limits<size_type>::max(),
+        Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void approximate_k_nearest(
+        const PointType& pt,
+        size_type k,
+        neighbour_heap<distance_type, size_type>& heap,
+        double eps,
+        size_type max_visits = std::numeric_limits<size_type>::max(),
+        Metric metric = Metric()) const;
+
+private:
+    std::vector<PointType> points_;
+    std::vector<std::vector<node>> trees_;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType>
+template <class InputIterator>
+kdtree_forest<PointType>::kdtree_forest(InputIterator first,
+                                        InputIterator last,
+                                        std::size_t trees,
+                                        std::uint32_t seed)
+    : points_(first, last), trees_(std::max(trees, std::size_t(1ul)))
+{
+    if(points_.empty())
+    {
+        return;
+    }
+
+    std::vector<size_type> order(points_.size());
+
+    for(std::size_t tree = 0ul; tree < trees_.size(); ++tree)
+    {
+        std::mt19937 random(seed + static_cast<std::uint32_t>(tree));
+        std::iota(order.begin(), order.end(), 0ul);
+
+        trees_[tree].resize(points_.size());
+        build_helper(trees_[tree], order.data(), 0ul, order.size(), random);
+    }
+}
+
+template <class PointType>
+typename kdtree_forest<PointType>::visit_marks&
+kdtree_forest<PointType>::scratch_marks()
+{
+    thread_local visit_marks marks;
+    return marks;
+}
+
+template <class PointType>
+std::size_t
+kdtree_forest<PointType>::choose_dimension(const size_type* first,
+                                           const size_type* last,
+                                           std::mt19937& random) const
+{
+    const std::size_t dims = point_traits<PointType>::dimensions;
+    const size_type n = static_cast<size_type>(last - first);
+    const size_type step = std::max(n / variance_samples, size_type(1ul));
+
+    // reused across nodes, a build visits every point of every tree
+    thread_local std::vector<double> mean;
+    thread_local std::vector<double> squares;
+    thread_local std::vector<std::pair<double, std::size_t>> spread;
+    mean.assign(dims, 0.0);
+    squares.assign(dims, 0.0);
+    spread.resize(dims);
+
+    size_type samples = 0ul;
+
+    for(const size_type* it = first; it < last; it += step, ++samples)
+    {
+        for(std::size_t dim = 0ul; dim < dims; ++dim)
+        {
+            const double value =
+                static_cast<double>(coordinate(points_[*it], dim));
+            mean[dim] += value;
+            squares[dim] += value * value;
+        }
+    }
+
+    // dimensions by descending variance
+    for(std::size_t dim = 0ul; dim < dims; ++dim)
+    {
+        const double m = mean[dim] / samples;
+        spread[dim] = {squares[dim] / samples - m * m, dim};
+    }
+
+    const std::size_t candidates = std::min(candidate_dimensions, dims);
+    std::partial_sort(spread.begin(),
+                      spread.begin() + candidates,
+                      spread.end(),
+                      [](const std::pair<double, std::size_t>& lhs,
+                         const std::pair<double, std::size_t>& rhs) {
+                          return rhs.first < lhs.first;
+                      });
+
+    std::uniform_int_distribution<std::size_t> pick(0ul, candidates - 1ul);
+    return spread[pick(random)].second;
+}
+
+template <class PointType>
+typename kdtree_forest<PointType>::size_type
+kdtree_forest<PointType>::build_helper(std::vector<node>& nodes,
+                                       size_type* order,
+                                       size_type first,
+                                       size_type last,
+                                       std::mt19937& random) const
+{
+    const std::size_t dim =
+        choose_dimension(order + first, order + last, random);
+    const size_type median = first + (last - first) / 2ul;
+
+    std::nth_element(order + first,
+                     order + median,
+                     order + last,
+                     [this, dim](size_type lhs, size_type rhs) {
+                         return less(points_[lhs], points_[rhs], dim);
+                     });
+
+    // median becomes the subtree root at the front of its range
+    std::swap(order[first], order[median]);
+
+    nodes[first] = node{order[first], 0ul, 0ul, dim};
+
+    if(first < median)
+    {
+        nodes[first].smaller =
+            build_helper(nodes, order, first + 1ul, median + 1ul, random);
+    }
+
+    if(median + 1ul < last)
+    {
+        nodes[first].bigger =
+            build_helper(nodes, order, median + 1ul, last, random);
+    }
+
+    return first;
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+kdtree_forest<PointType>::k_nearest(const PointType& pt,
+                                    size_type k,
+                                    OutputIterator out,
+                                    Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Metric>
+void
+kdtree_forest<PointType>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul || points_.empty())
+    {
+        return;
+    }
+
+    kdtree_detail::nearest_query<PointType, Metric> query{
+        points_.data(), pt, metric, heap};
+    kdtree_detail::search(
+        points_.data(), topology{trees_.front().data()}, query);
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+kdtree_forest<PointType>::approximate_k_nearest(const PointType& pt,
+                                                size_type k,
+                                                OutputIterator out,
+                                                double eps,
+                                                size_type max_visits,
+                                                Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    approximate_k_nearest(pt, k, heap, eps, max_visits, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Metric>
+void
+kdtree_forest<PointType>::approximate_k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    double eps,
+    size_type max_visits,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul || points_.empty())
+    {
+        return;
+    }
+
+    visit_marks& scratch = scratch_marks();
+    if(scratch.marks.size() < points_.size())
+    {
+        scratch.marks.resize(points_.size(), 0u);
+    }
+
+    // a wrapped stamp could match marks left by earlier queries
+    if(++scratch.stamp == 0u)
+    {
+        std::fill(scratch.marks.begin(), scratch.marks.end(), 0u);
+        scratch.stamp = 1u;
+    }
+
+    forest_query<Metric> query{{{points_.data(), pt, metric, heap}, 1.0 + eps},
+                               scratch.marks.data(),
+                               scratch.stamp};
+
+    const size_type share = max_visits / trees_.size();
+    const size_type remainder = max_visits % trees_.size();
+
+    for(std::size_t tree = 0ul; tree < trees_.size(); ++tree)
+    {
+        const size_type visits = share + (tree < remainder ? 1ul : 0ul);
+
+        if(visits > 0ul)
+        {
+            kdtree_detail::best_first_search(
+                points_.data(), topology{trees_[tree].data()}, query, visits);
+        }
+    }
+}
+} // namespace multidim
+} // namespace useful
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "point_traits.hpp"
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// Read-only kdtree backed by a snapshot written with kdtree::save. The file
+// is mapped into memory and queried in place, so opening only takes a pass
+// over the records to validate them, and the pages are shared by every
+// process mapping the same snapshot. Requires POSIX mmap.
+template <class PointType>
+class mapped_kdtree
+{
+    static_assert(std::is_trivially_copyable<PointType>::value,
+                  "snapshots require trivially copyable points");
+
+    typedef typename kdtree<PointType>::record record;
+    typedef typename kdtree<PointType>::topology topology;
+
+public:
+    typedef std::size_t size_type;
+    typedef const PointType* const_unsorted_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+private:
+    template <class Query>
+    void
+    search(Query& query) const
+    {
+        if(count_)
+        {
+            kdtree_detail::search(points_, topology{records_}, query);
+        }
+    }
+
+    void unmap();
+
+public:
+    mapped_kdtree() = default;
+
+    // Throws std::runtime_error if path cannot be mapped or is not an intact
+    // snapshot of a kdtree<PointType>.
+    explicit mapped_kdtree(const std::string& path);
+
+    mapped_kdtree(const mapped_kdtree&) = delete;
+    mapped_kdtree& operator=(const mapped_kdtree&) = delete;
+
+    mapped_kdtree(mapped_kdtree&& other);
+
+    mapped_kdtree& operator=(mapped_kdtree&& other);
+
+    ~mapped_kdtree()
+    {
+        unmap();
+    }
+
+    bool
+    empty() const
+    {
+        return count_ == 0ul;
+    }
+
+    size_type
+    size() const
+    {
+        return count_ - erased_;
+    }
+
+    // as for kdtree, the unsorted range includes erased points
+    const_unsorted_iterator
+    cbegin() const
+    {
+        return points_;
+    }
+
+    const_unsorted_iterator
+    cend() const
+    {
+        return points_ + count_;
+    }
+
+    bool
+    erased(const_unsorted_iterator pos) const
+    {
+        return records_[pos - points_].erased;
+    }
+
+    template <class Metric = squared_euclidean>
+    const_unsorted_iterator nearest(const PointType& pt,
+                                    Metric metric = Metric()) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    // as kdtree::k_nearest_batch
+    template <class RandomAccessIterator,
+              class RandomAccessOutputIterator,
+              class Metric = squared_euclidean>
+    void
+    k_nearest_batch(RandomAccessIterator first,
+                    RandomAccessIterator last,
+                    size_type k,
+                    RandomAccessOutputIterator out,
+                    unsigned threads = 1u,
+                    bool spatial_order = true,
+                    Metric metric = Metric()) const
+    {
+        kdtree_detail::k_nearest_batch(
+            *this, first, last, k, out, threads, spatial_order, metric);
+    }
+
+    template <class OutputIterator>
+    OutputIterator range_query(const PointType& min_pt,
+                               const PointType& max_pt,
+                               OutputIterator out) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator radius_query(const PointType& center,
+                                distance_type r,
+                                OutputIterator out,
+                                Metric metric = Metric()) const;
+
+private:
+    void* mapping_ = nullptr;
+    size_type mapping_size_ = 0ul;
+    const PointType* points_ = nullptr;
+    const record* records_ = nullptr;
+    size_type count_ = 0ul;
+    size_type erased_ = 0ul;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType>
+mapped_kdtree<PointType>::mapped_kdtree(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("could not open kdtree snapshot " + path);
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) != 0 ||
+       static_cast<std::size_t>(info.st_size) <
+           sizeof(kdtree_detail::snapshot_header))
+    {
+        ::close(fd);
+        throw std::runtime_error("truncated kdtree snapshot");
+    }
+
+    void* mapping = ::mmap(nullptr,
+                           static_cast<std::size_t>(info.st_size),
+                           PROT_READ,
+                           MAP_SHARED,
+                           fd,
+                           0);
+    ::close(fd);
+
+    if(mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("could not map kdtree snapshot " + path);
+    }
+
+    mapping_ = mapping;
+    mapping_size_ = static_cast<std::size_t>(info.st_size);
+
+    const char* bytes = static_cast<const char*>(mapping_);
+    const auto& header =
+        *reinterpret_cast<const kdtree_detail::snapshot_header*>(bytes);
+
+    try
+    {
+        kdtree_detail::check_snapshot_header<PointType, record>(
+            header, mapping_size_);
+
+        const record* records = reinterpret_cast<const record*>(
+            bytes + kdtree_detail::snapshot_records_offset(
+                        header.size, sizeof(PointType)));
+        kdtree_detail::check_snapshot_records(
+            records,
+            header.size,
+            header.erased,
+            point_traits<PointType>::dimensions);
+    }
+    catch(...)
+    {
+        unmap();
+        throw;
+    }
+
+    count_ = header.size;
+    erased_ = header.erased;
+    points_ = reinterpret_cast<const PointType*>(
+        bytes + sizeof(kdtree_detail::snapshot_header));
+    records_ = reinterpret_cast<const record*>(
+        bytes +
+        kdtree_detail::snapshot_records_offset(count_, sizeof(PointType)));
+}
+
+template <class PointType>
+mapped_kdtree<PointType>::mapped_kdtree(mapped_kdtree&& other)
+    : mapping_(other.mapping_),
+      mapping_size_(other.mapping_size_),
+      points_(other.points_),
+      records_(other.records_),
+      count_(other.count_),
+      erased_(other.erased_)
+{
+    other.mapping_ = nullptr;
+    other.count_ = 0ul;
+    other.erased_ = 0ul;
+}
+
+template <class PointType>
+mapped_kdtree<PointType>&
+mapped_kdtree<PointType>::operator=(mapped_kdtree&& other)
+{
+    if(this != &other)
+    {
+        unmap();
+
+        std::swap(mapping_, other.mapping_);
+        std::swap(mapping_size_, other.mapping_size_);
+        std::swap(points_, other.points_);
+        std::swap(records_, other.records_);
+        std::swap(count_, other.count_);
+        std::swap(erased_, other.erased_);
+    }
+
+    return *this;
+}
+
+template <class PointType>
+void
+mapped_kdtree<PointType>::unmap()
+{
+    if(mapping_)
+    {
+        ::munmap(mapping_, mapping_size_);
+    }
+
+    mapping_ = nullptr;
+    mapping_size_ = 0ul;
+    points_ = nullptr;
+    records_ = nullptr;
+    count_ = 0ul;
+    erased_ = 0ul;
+}
+
+template <class PointType>
+template <class Metric>
+typename mapped_kdtree<PointType>::const_unsorted_iterator
+mapped_kdtree<PointType>::nearest(const PointType& pt, Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, 1ul, heap, metric);
+
+    if(heap.empty())
+    {
+        return cend();
+    }
+
+    return points_ + heap.begin()->index;
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+mapped_kdtree<PointType>::k_nearest(const PointType& pt,
+                                    size_type k,
+                                    OutputIterator out,
+                                    Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Metric>
+void
+mapped_kdtree<PointType>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul)
+    {
+        return;
+    }
+
+    kdtree_detail::nearest_query<PointType, Metric> query{
+        points_, pt, metric, heap};
+    search(query);
+}
+
+template <class PointType>
+template <class OutputIterator>
+OutputIterator
+mapped_kdtree<PointType>::range_query(const PointType& min_pt,
+                                      const PointType& max_pt,
+                                      OutputIterator out) const
+{
+    kdtree_detail::range_query<PointType, OutputIterator> query{
+        points_, min_pt, max_pt, out};
+    search(query);
+
+    return query.out;
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+mapped_kdtree<PointType>::radius_query(const PointType& center,
+                                       distance_type r,
+                                       OutputIterator out,
+                                       Metric metric) const
+{
+    kdtree_detail::radius_query<PointType, OutputIterator, Metric> query{
+        points_, center, r, metric, out};
+    search(query);
+
+    return query.out;
+}
+} // namespace multidim
+} // namespace useful
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+namespace useful
+{
+
+// Calls fn(first, last) for the chunks [0, chunk), [chunk, 2 * chunk), ...
+// of [0, size), the last chunk possibly shorter, on up to threads threads
+// including the calling one. The chunk boundaries only depend on size and
+// chunk, so with chunk * sizeof(T) a multiple of 64 over cache line aligned
+// storage of T no two chunks share a cache line. Threads claim the next
+// unclaimed chunk whenever they finish one, so threads done early take over
+// the work of slower ones. fn is called concurrently and must only touch
+// the elements of its own chunk. If fn throws, no further chunks are
+// started and one of the exceptions is rethrown once every thread stopped.
+template <class Function>
+void
+parallel_for(std::size_t size,
+             std::size_t chunk,
+             Function fn,
+             unsigned threads = std::thread::hardware_concurrency())
+{
+    if(chunk == 0)
+    {
+        throw std::runtime_error("parallel_for requires a positive chunk");
+    }
+
+    const std::size_t chunks = (size + chunk - 1) / chunk;
+    threads = static_cast<unsigned>(std::max<std::size_t>(
+        1ul, std::min<std::size_t>(threads, chunks)));
+
+    std::atomic<std::size_t> next(0);
+
+    auto run = [&]() {
+        try
+        {
+            for(std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+                i < chunks;
+                i = next.fetch_add(1, std::memory_order_relaxed))
+            {
+                fn(i * chunk, std::min(size, (i + 1) * chunk));
+            }
+        }
+        catch(...)
+        {
+            next.store(chunks, std::memory_order_relaxed);
+            throw;
+        }
+    };
+
+    std::vector<std::future<void>> workers;
+    for(unsigned i = 1; i < threads; ++i)
+    {
+        workers.push_back(std::async(std::launch::async, run));
+    }
+
+    std::exception_ptr error;
+    try
+    {
+        run();
+    }
+    catch(...)
+    {
+        error = std::current_exception();
+    }
+
+    for(auto& worker : workers)
+    {
+        try
+        {
+            worker.get();
+        }
+        catch(...)
+        {
+            if(!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+} // namespace useful
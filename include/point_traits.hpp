@@ -1,10 +1,15 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
+#include <future>
+#include <tuple>
+#include <vector>
 #include <type_traits>
 #include <iterator>
 #include <algorithm>
 #include <numeric>
+#include <utility>
 
 namespace useful
 {
@@ -21,7 +26,7 @@ using point_traits = point_traits_<PointType, void, void, void>;
 template <class T, std::size_t N>
 struct point_traits_<T[N], void, void, void>
 {
-    static const std::size_t dimensions = N;
+    static constexpr std::size_t dimensions = N;
 
     template <std::size_t U>
     using value_type = T;
@@ -31,9 +36,126 @@ struct point_traits_<T[N], void, void, void>
     {
         return pt[U];
     }
+
+    template <std::size_t U>
+    static const value_type<U>& get(const T (&pt)[N])
+    {
+        return pt[U];
+    }
+};
+
+
+template <class T, std::size_t N>
+struct point_traits_<std::array<T, N>, void, void, void>
+{
+    static constexpr std::size_t dimensions = N;
+
+    template <std::size_t U>
+    using value_type = T;
+
+    template <std::size_t U>
+    static value_type<U>&
+    get(std::array<T, N>& pt)
+    {
+        return std::get<U>(pt);
+    }
+
+    template <std::size_t U>
+    static const value_type<U>&
+    get(const std::array<T, N>& pt)
+    {
+        return std::get<U>(pt);
+    }
 };
 
 
+template <class... Ts>
+struct point_traits_<std::tuple<Ts...>, void, void, void>
+{
+    static constexpr std::size_t dimensions = sizeof...(Ts);
+
+    template <std::size_t U>
+    using value_type = std::tuple_element_t<U, std::tuple<Ts...>>;
+
+    template <std::size_t U>
+    static value_type<U>&
+    get(std::tuple<Ts...>& pt)
+    {
+        return std::get<U>(pt);
+    }
+
+    template <std::size_t U>
+    static const value_type<U>&
+    get(const std::tuple<Ts...>& pt)
+    {
+        return std::get<U>(pt);
+    }
+};
+
+
+namespace point_traits_detail
+{
+template <class Member>
+struct member_type;
+
+template <class T, class PointType>
+struct member_type<T PointType::*>
+{
+    typedef T type;
+};
+
+// traits of a point whose dimensions are the data members Members, given as
+// member pointers
+template <class PointType, auto... Members>
+struct member_traits
+{
+    static constexpr std::size_t dimensions = sizeof...(Members);
+
+    template <std::size_t U>
+    using value_type = typename member_type<
+        std::tuple_element_t<U, std::tuple<decltype(Members)...>>>::type;
+
+    template <std::size_t U>
+    static value_type<U>&
+    get(PointType& pt)
+    {
+        return pt.*std::get<U>(std::make_tuple(Members...));
+    }
+
+    template <std::size_t U>
+    static const value_type<U>&
+    get(const PointType& pt)
+    {
+        return pt.*std::get<U>(std::make_tuple(Members...));
+    }
+};
+
+// traits of a point of N values of type T accessed with operator[]
+template <class PointType, class T, std::size_t N>
+struct indexed_traits
+{
+    static constexpr std::size_t dimensions = N;
+
+    template <std::size_t U>
+    using value_type = T;
+
+    template <std::size_t U>
+    static value_type<U>&
+    get(PointType& pt)
+    {
+        return pt[U];
+    }
+
+    template <std::size_t U>
+    static const value_type<U>&
+    get(const PointType& pt)
+    {
+        return pt[U];
+    }
+};
+} // namespace point_traits_detail
+
+
 namespace xyz_detail
 {
 template <std::size_t, class T>
@@ -101,7 +223,7 @@ struct point_traits_<PointType,
                      Y,
                      Z>
 {
-    static const std::size_t dimensions = 1;
+    static constexpr std::size_t dimensions = 1;
 
     template <std::size_t U>
     using value_type = typename xyz_detail::helper<U, PointType>::type;
@@ -128,7 +250,7 @@ struct point_traits_<PointType,
                      std::void_t<decltype(std::declval<PointType>().y)>,
                      Z>
 {
-    static const std::size_t dimensions = 2;
+    static constexpr std::size_t dimensions = 2;
 
     template <std::size_t U>
     using value_type = typename xyz_detail::helper<U, PointType>::type;
@@ -155,7 +277,7 @@ struct point_traits_<PointType,
                      std::void_t<decltype(std::declval<PointType>().y)>,
                      std::void_t<decltype(std::declval<PointType>().z)>>
 {
-    static const std::size_t dimensions = 3;
+    static constexpr std::size_t dimensions = 3;
 
     template <std::size_t U>
     using value_type = typename xyz_detail::helper<U, PointType>::type;
@@ -184,6 +306,29 @@ namespace useful
 namespace multidim
 {
 
+namespace point_traits_detail
+{
+template <class PointType, class IndexSequence>
+struct coordinate_type_;
+
+template <class PointType, std::size_t... Dims>
+struct coordinate_type_<PointType, std::index_sequence<Dims...>>
+{
+    typedef std::common_type_t<typename point_traits<
+        PointType>::template value_type<Dims>...>
+        type;
+};
+} // namespace point_traits_detail
+
+
+// arithmetic type all dimensions of PointType can be converted to, used for
+// runtime access to coordinates and for distances between points
+template <class PointType>
+using coordinate_type = typename point_traits_detail::coordinate_type_<
+    PointType,
+    std::make_index_sequence<point_traits<PointType>::dimensions>>::type;
+
+
 namespace point_traits_detail
 {
 template <class PointType,
@@ -218,6 +363,84 @@ struct helper
 
         helper<PointType, N - 1>::apply(pt, f);
     }
+
+    static coordinate_type<PointType>
+    squared_distance(const PointType& lhs, const PointType& rhs)
+    {
+        const coordinate_type<PointType> diff =
+            point_traits<PointType>::template get<N>(lhs) -
+            point_traits<PointType>::template get<N>(rhs);
+
+        return diff * diff +
+               helper<PointType, N - 1>::squared_distance(lhs, rhs);
+    }
+
+    static coordinate_type<PointType>
+    absolute_difference(const PointType& lhs, const PointType& rhs)
+    {
+        const coordinate_type<PointType> l =
+            point_traits<PointType>::template get<N>(lhs);
+        const coordinate_type<PointType> r =
+            point_traits<PointType>::template get<N>(rhs);
+
+        return l < r ? r - l : l - r;
+    }
+
+    static coordinate_type<PointType>
+    manhattan_distance(const PointType& lhs, const PointType& rhs)
+    {
+        return absolute_difference(lhs, rhs) +
+               helper<PointType, N - 1>::manhattan_distance(lhs, rhs);
+    }
+
+    static coordinate_type<PointType>
+    chebyshev_distance(const PointType& lhs, const PointType& rhs)
+    {
+        return std::max(
+            absolute_difference(lhs, rhs),
+            helper<PointType, N - 1>::chebyshev_distance(lhs, rhs));
+    }
+
+    static coordinate_type<PointType>
+    dot(const PointType& lhs, const PointType& rhs)
+    {
+        return static_cast<coordinate_type<PointType>>(
+                   point_traits<PointType>::template get<N>(lhs)) *
+                   point_traits<PointType>::template get<N>(rhs) +
+               helper<PointType, N - 1>::dot(lhs, rhs);
+    }
+
+    static void
+    gather(const PointType& pt, double* out)
+    {
+        out[N] = static_cast<double>(
+            point_traits<PointType>::template get<N>(pt));
+
+        helper<PointType, N - 1>::gather(pt, out);
+    }
+
+    static void
+    scatter(const double* values, PointType& out)
+    {
+        typedef typename point_traits<PointType>::template value_type<N> value;
+        point_traits<PointType>::template get<N>(out) =
+            static_cast<value>(values[N]);
+
+        helper<PointType, N - 1>::scatter(values, out);
+    }
+
+    static void
+    extend(const PointType& pt, PointType& low, PointType& high)
+    {
+        const auto& value = point_traits<PointType>::template get<N>(pt);
+        auto& min = point_traits<PointType>::template get<N>(low);
+        auto& max = point_traits<PointType>::template get<N>(high);
+
+        min = value < min ? value : min;
+        max = max < value ? value : max;
+
+        helper<PointType, N - 1>::extend(pt, low, high);
+    }
 };
 
 
@@ -246,6 +469,73 @@ struct helper<PointType, 0>
     {
         f(point_traits<PointType>::template get<0>(pt));
     }
+
+    static coordinate_type<PointType>
+    squared_distance(const PointType& lhs, const PointType& rhs)
+    {
+        const coordinate_type<PointType> diff =
+            point_traits<PointType>::template get<0>(lhs) -
+            point_traits<PointType>::template get<0>(rhs);
+
+        return diff * diff;
+    }
+
+    static coordinate_type<PointType>
+    absolute_difference(const PointType& lhs, const PointType& rhs)
+    {
+        const coordinate_type<PointType> l =
+            point_traits<PointType>::template get<0>(lhs);
+        const coordinate_type<PointType> r =
+            point_traits<PointType>::template get<0>(rhs);
+
+        return l < r ? r - l : l - r;
+    }
+
+    static coordinate_type<PointType>
+    manhattan_distance(const PointType& lhs, const PointType& rhs)
+    {
+        return absolute_difference(lhs, rhs);
+    }
+
+    static coordinate_type<PointType>
+    chebyshev_distance(const PointType& lhs, const PointType& rhs)
+    {
+        return absolute_difference(lhs, rhs);
+    }
+
+    static coordinate_type<PointType>
+    dot(const PointType& lhs, const PointType& rhs)
+    {
+        return static_cast<coordinate_type<PointType>>(
+                   point_traits<PointType>::template get<0>(lhs)) *
+               point_traits<PointType>::template get<0>(rhs);
+    }
+
+    static void
+    gather(const PointType& pt, double* out)
+    {
+        out[0] = static_cast<double>(
+            point_traits<PointType>::template get<0>(pt));
+    }
+
+    static void
+    scatter(const double* values, PointType& out)
+    {
+        typedef typename point_traits<PointType>::template value_type<0> value;
+        point_traits<PointType>::template get<0>(out) =
+            static_cast<value>(values[0]);
+    }
+
+    static void
+    extend(const PointType& pt, PointType& low, PointType& high)
+    {
+        const auto& value = point_traits<PointType>::template get<0>(pt);
+        auto& min = point_traits<PointType>::template get<0>(low);
+        auto& max = point_traits<PointType>::template get<0>(high);
+
+        min = value < min ? value : min;
+        max = max < value ? value : max;
+    }
 };
 
 
@@ -266,6 +556,18 @@ struct compare_helper
         return point_traits<PointType>::template get<N>(lhs) <
                point_traits<PointType>::template get<N>(rhs);
     }
+
+    static coordinate_type<PointType>
+    coordinate(const PointType& pt, std::size_t dim)
+    {
+        if(N != dim)
+        {
+            return compare_helper<PointType, N + 1, DimMax>::coordinate(pt,
+                                                                        dim);
+        }
+
+        return point_traits<PointType>::template get<N>(pt);
+    }
 };
 
 
@@ -278,6 +580,12 @@ struct compare_helper<PointType, DimMax, DimMax>
         return point_traits<PointType>::template get<DimMax>(lhs) <
                point_traits<PointType>::template get<DimMax>(rhs);
     }
+
+    static coordinate_type<PointType>
+    coordinate(const PointType& pt, std::size_t)
+    {
+        return point_traits<PointType>::template get<DimMax>(pt);
+    }
 };
 
 
@@ -292,6 +600,15 @@ less(const PointType& lhs, const PointType& rhs, std::size_t dim)
 }
 
 
+// value of dimension dim of pt where dim is only known at runtime
+template <class PointType>
+coordinate_type<PointType>
+coordinate(const PointType& pt, std::size_t dim)
+{
+    return point_traits_detail::compare_helper<PointType>::coordinate(pt, dim);
+}
+
+
 template <class PointType>
 PointType
 add(const PointType& lhs, const PointType& rhs)
@@ -314,19 +631,281 @@ divide(const PointType& lhs, Arithmetic rhs)
     return out;
 }
 
+namespace point_traits_detail
+{
+// ranges shorter than this are reduced by a single thread
+constexpr std::size_t parallel_reduce_threshold = 1ul << 14;
+
+// Reduces [first, last) by folding every point into a Partial with
+// accumulate, over up to threads chunks each on its own thread. Partials are
+// merged pairwise, in a balanced tree, so rounding errors of sums grow with
+// the logarithm of the number of chunks only.
+template <class Partial, class Iterator, class Accumulate, class Merge>
+Partial
+reduce_points(Iterator first,
+              Iterator last,
+              unsigned threads,
+              Accumulate accumulate,
+              Merge merge)
+{
+    const std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    const std::size_t chunks = std::max<std::size_t>(
+        1ul, std::min<std::size_t>(threads, n / parallel_reduce_threshold));
+
+    const auto run = [&accumulate](Iterator begin, Iterator end) {
+        Partial out;
+        for(; begin != end; ++begin)
+        {
+            accumulate(out, *begin);
+        }
+
+        return out;
+    };
+
+    std::vector<Partial> partials;
+    partials.reserve(chunks);
+
+    if(chunks == 1ul)
+    {
+        partials.push_back(run(first, last));
+    }
+    else
+    {
+        std::vector<std::future<Partial>> workers;
+        const std::size_t chunk = (n + chunks - 1ul) / chunks;
+
+        Iterator begin = first;
+        for(std::size_t i = 1ul; i < chunks; ++i)
+        {
+            const Iterator end = std::next(begin, chunk);
+            workers.push_back(std::async(std::launch::async, run, begin, end));
+            begin = end;
+        }
+
+        partials.push_back(run(begin, last));
+
+        for(auto& worker : workers)
+        {
+            partials.push_back(worker.get());
+        }
+    }
+
+    for(std::size_t step = 1ul; step < partials.size(); step *= 2ul)
+    {
+        for(std::size_t i = 0; i + step < partials.size(); i += 2ul * step)
+        {
+            merge(partials[i], partials[i + step]);
+        }
+    }
+
+    return partials.front();
+}
+
+
+// per dimension sums in double precision with Kahan compensation
+template <std::size_t Dims>
+struct compensated_sum
+{
+    void
+    add(std::size_t dim, double value)
+    {
+        const double y = value - carry[dim];
+        const double t = sum[dim] + y;
+        carry[dim] = (t - sum[dim]) - y;
+        sum[dim] = t;
+    }
+
+    void
+    merge(const compensated_sum& other)
+    {
+        for(std::size_t dim = 0; dim < Dims; ++dim)
+        {
+            add(dim, other.sum[dim]);
+            add(dim, -other.carry[dim]);
+        }
+
+        count += other.count;
+    }
+
+    double
+    total(std::size_t dim) const
+    {
+        return sum[dim] - carry[dim];
+    }
+
+    std::size_t count = 0ul;
+    std::array<double, Dims> sum{};
+    std::array<double, Dims> carry{};
+};
+
+
+// Welford's running mean and sum of squared deviations per dimension
+template <std::size_t Dims>
+struct running_moments
+{
+    void
+    add(const double* values)
+    {
+        ++count;
+        for(std::size_t dim = 0; dim < Dims; ++dim)
+        {
+            const double delta = values[dim] - mean[dim];
+            mean[dim] += delta / static_cast<double>(count);
+            m2[dim] += delta * (values[dim] - mean[dim]);
+        }
+    }
+
+    // Chan et al.'s combination of the moments of two disjoint sets
+    void
+    merge(const running_moments& other)
+    {
+        if(other.count == 0ul)
+        {
+            return;
+        }
+
+        const double n = static_cast<double>(count + other.count);
+        const double weight = static_cast<double>(other.count) / n;
+        const double cross = static_cast<double>(count) * weight;
+
+        for(std::size_t dim = 0; dim < Dims; ++dim)
+        {
+            const double delta = other.mean[dim] - mean[dim];
+            mean[dim] += delta * weight;
+            m2[dim] += other.m2[dim] + delta * delta * cross;
+        }
+
+        count += other.count;
+    }
+
+    std::size_t count = 0ul;
+    std::array<double, Dims> mean{};
+    std::array<double, Dims> m2{};
+};
+} // namespace point_traits_detail
+
+
+// Mean of the points in [first, last), which must not be empty. Coordinates
+// are summed in double precision with Kahan compensation, over up to threads
+// chunks for large ranges, and the result is converted back to the point's
+// types.
 template <class Iterator>
 typename std::iterator_traits<Iterator>::value_type
-arithmetic_mean(Iterator first, Iterator last)
+arithmetic_mean(Iterator first, Iterator last, unsigned threads = 1u)
 {
-    const auto n = std::distance(first, last);
+    typedef typename std::iterator_traits<Iterator>::value_type point_type;
+    constexpr std::size_t dims = point_traits<point_type>::dimensions;
+    typedef point_traits_detail::compensated_sum<dims> partial;
+
+    const partial sums = point_traits_detail::reduce_points<partial>(
+        first,
+        last,
+        threads,
+        [](partial& out, const point_type& pt) {
+            double values[dims];
+            point_traits_detail::helper<point_type>::gather(pt, values);
+
+            for(std::size_t dim = 0; dim < dims; ++dim)
+            {
+                out.add(dim, values[dim]);
+            }
+            ++out.count;
+        },
+        [](partial& out, const partial& other) { out.merge(other); });
+
+    double mean[dims];
+    for(std::size_t dim = 0; dim < dims; ++dim)
+    {
+        mean[dim] = sums.total(dim) / static_cast<double>(sums.count);
+    }
 
+    point_type out;
+    point_traits_detail::helper<point_type>::scatter(mean, out);
+
+    return out;
+}
+
+// Population variance of each dimension of the points in [first, last),
+// which must not be empty, computed in double precision with Welford's
+// method over up to threads chunks.
+template <class Iterator>
+typename std::iterator_traits<Iterator>::value_type
+variance(Iterator first, Iterator last, unsigned threads = 1u)
+{
     typedef typename std::iterator_traits<Iterator>::value_type point_type;
-    point_type out(*first++);
+    constexpr std::size_t dims = point_traits<point_type>::dimensions;
+    typedef point_traits_detail::running_moments<dims> partial;
+
+    const partial moments = point_traits_detail::reduce_points<partial>(
+        first,
+        last,
+        threads,
+        [](partial& out, const point_type& pt) {
+            double values[dims];
+            point_traits_detail::helper<point_type>::gather(pt, values);
+            out.add(values);
+        },
+        [](partial& out, const partial& other) { out.merge(other); });
+
+    double result[dims];
+    for(std::size_t dim = 0; dim < dims; ++dim)
+    {
+        result[dim] = moments.m2[dim] / static_cast<double>(moments.count);
+    }
 
+    point_type out;
+    point_traits_detail::helper<point_type>::scatter(result, out);
 
-    out = std::accumulate(first, last, out, &add<point_type>);
+    return out;
+}
 
-    return divide(out, n);
+// Smallest and biggest coordinate of each dimension over the points in
+// [first, last), which must not be empty, as a pair of corner points.
+template <class Iterator>
+std::pair<typename std::iterator_traits<Iterator>::value_type,
+          typename std::iterator_traits<Iterator>::value_type>
+bounding_box(Iterator first, Iterator last, unsigned threads = 1u)
+{
+    typedef typename std::iterator_traits<Iterator>::value_type point_type;
+
+    struct partial
+    {
+        bool empty = true;
+        point_type low;
+        point_type high;
+    };
+
+    const partial box = point_traits_detail::reduce_points<partial>(
+        first,
+        last,
+        threads,
+        [](partial& out, const point_type& pt) {
+            if(out.empty)
+            {
+                out.low = out.high = pt;
+                out.empty = false;
+            }
+            else
+            {
+                point_traits_detail::helper<point_type>::extend(
+                    pt, out.low, out.high);
+            }
+        },
+        [](partial& out, const partial& other) {
+            if(out.empty)
+            {
+                out = other;
+            }
+            else if(!other.empty)
+            {
+                point_traits_detail::helper<point_type>::extend(
+                    other.low, out.low, out.high);
+                point_traits_detail::helper<point_type>::extend(
+                    other.high, out.low, out.high);
+            }
+        });
+
+    return {box.low, box.high};
 }
 
 template <class PointType, class Function>
@@ -336,6 +915,320 @@ apply(PointType& pt, Function fun)
     point_traits_detail::helper<PointType>::apply(pt, fun);
 }
 
+template <class PointType>
+coordinate_type<PointType>
+squared_distance(const PointType& lhs, const PointType& rhs)
+{
+    return point_traits_detail::helper<PointType>::squared_distance(lhs, rhs);
+}
+
+// |lhs - rhs|, also for unsigned coordinates where lhs - rhs wraps around
+template <class Arithmetic>
+Arithmetic
+absolute_difference(Arithmetic lhs, Arithmetic rhs)
+{
+    return lhs < rhs ? rhs - lhs : lhs - rhs;
+}
+
+// sum of the absolute differences over all dimensions
+template <class PointType>
+coordinate_type<PointType>
+manhattan_distance(const PointType& lhs, const PointType& rhs)
+{
+    return point_traits_detail::helper<PointType>::manhattan_distance(lhs,
+                                                                      rhs);
+}
+
+// largest absolute difference in any dimension
+template <class PointType>
+coordinate_type<PointType>
+chebyshev_distance(const PointType& lhs, const PointType& rhs)
+{
+    return point_traits_detail::helper<PointType>::chebyshev_distance(lhs,
+                                                                      rhs);
+}
+
+template <class PointType>
+coordinate_type<PointType>
+dot(const PointType& lhs, const PointType& rhs)
+{
+    return point_traits_detail::helper<PointType>::dot(lhs, rhs);
+}
+
+
+// Distance metrics used by spatial queries. A metric is a function object
+// returning the distance between two points, axis(offset) returning a
+// lower bound of that distance for two points separated by offset along a
+// single dimension, and combine(acc, value) folding the axis values of each
+// dimension into the distance, starting from zero.
+struct squared_euclidean
+{
+    template <class PointType>
+    coordinate_type<PointType>
+    operator()(const PointType& lhs, const PointType& rhs) const
+    {
+        return squared_distance(lhs, rhs);
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    axis(Arithmetic offset) const
+    {
+        return offset * offset;
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    combine(Arithmetic acc, Arithmetic value) const
+    {
+        return acc + value;
+    }
+};
+
+struct manhattan
+{
+    template <class PointType>
+    coordinate_type<PointType>
+    operator()(const PointType& lhs, const PointType& rhs) const
+    {
+        return manhattan_distance(lhs, rhs);
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    axis(Arithmetic offset) const
+    {
+        return offset < Arithmetic() ? -offset : offset;
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    combine(Arithmetic acc, Arithmetic value) const
+    {
+        return acc + value;
+    }
+};
+
+struct chebyshev
+{
+    template <class PointType>
+    coordinate_type<PointType>
+    operator()(const PointType& lhs, const PointType& rhs) const
+    {
+        return chebyshev_distance(lhs, rhs);
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    axis(Arithmetic offset) const
+    {
+        return offset < Arithmetic() ? -offset : offset;
+    }
+
+    template <class Arithmetic>
+    Arithmetic
+    combine(Arithmetic acc, Arithmetic value) const
+    {
+        return acc < value ? value : acc;
+    }
+};
+
+
+namespace point_traits_detail
+{
+// Points made of dimensions contiguous floating point values that can be
+// indexed like an array. The batched kernels treat a span of them as a
+// matrix, which compilers vectorize across points.
+template <class PointType>
+struct flat_layout : std::false_type
+{
+};
+
+template <class T, std::size_t N>
+struct flat_layout<T[N]> : std::is_floating_point<T>
+{
+};
+
+template <class T, std::size_t N>
+struct flat_layout<std::array<T, N>> : std::is_floating_point<T>
+{
+};
+
+// per dimension step of a batched kernel, accumulating into acc the
+// contribution of a point's value against the query's
+template <class Kernel>
+struct flat_kernel
+{
+    static constexpr bool available = false;
+};
+
+template <>
+struct flat_kernel<squared_euclidean>
+{
+    static constexpr bool available = true;
+
+    template <class T>
+    static T
+    step(T acc, T value, T query)
+    {
+        const T diff = value - query;
+        return acc + diff * diff;
+    }
+};
+
+template <>
+struct flat_kernel<manhattan>
+{
+    static constexpr bool available = true;
+
+    template <class T>
+    static T
+    step(T acc, T value, T query)
+    {
+        const T diff = value - query;
+        return acc + (diff < T() ? -diff : diff);
+    }
+};
+
+template <>
+struct flat_kernel<chebyshev>
+{
+    static constexpr bool available = true;
+
+    template <class T>
+    static T
+    step(T acc, T value, T query)
+    {
+        const T diff = value - query;
+        const T magnitude = diff < T() ? -diff : diff;
+        return acc < magnitude ? magnitude : acc;
+    }
+};
+
+struct dot_kernel
+{
+    template <class T>
+    static T
+    step(T acc, T value, T query)
+    {
+        return acc + value * query;
+    }
+};
+
+template <class Kernel, class PointType>
+void
+flat_batch(const PointType& query,
+           const PointType* points,
+           std::size_t n,
+           coordinate_type<PointType>* out)
+{
+    typedef coordinate_type<PointType> value_type;
+    constexpr std::size_t dims = point_traits<PointType>::dimensions;
+
+    value_type q[dims];
+    for(std::size_t dim = 0; dim < dims; ++dim)
+    {
+        q[dim] = query[dim];
+    }
+
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        value_type acc = value_type();
+        for(std::size_t dim = 0; dim < dims; ++dim)
+        {
+            acc = Kernel::step(acc, points[i][dim], q[dim]);
+        }
+
+        out[i] = acc;
+    }
+}
+} // namespace point_traits_detail
+
+
+// Writes metric(query, p) for every p in [first, last) to out. For arrays of
+// float or double with one of the metrics above the loop is laid out for the
+// compiler to vectorize.
+template <class PointType, class Metric = squared_euclidean>
+void
+distances(const PointType& query,
+          const PointType* first,
+          const PointType* last,
+          coordinate_type<PointType>* out,
+          Metric metric = Metric())
+{
+    if constexpr(point_traits_detail::flat_layout<PointType>::value &&
+                 point_traits_detail::flat_kernel<Metric>::available)
+    {
+        point_traits_detail::flat_batch<
+            point_traits_detail::flat_kernel<Metric>>(
+            query, first, static_cast<std::size_t>(last - first), out);
+    }
+    else
+    {
+        for(; first != last; ++first, ++out)
+        {
+            *out = metric(query, *first);
+        }
+    }
+}
+
+// writes dot(query, p) for every p in [first, last) to out
+template <class PointType>
+void
+dot_products(const PointType& query,
+             const PointType* first,
+             const PointType* last,
+             coordinate_type<PointType>* out)
+{
+    if constexpr(point_traits_detail::flat_layout<PointType>::value)
+    {
+        point_traits_detail::flat_batch<point_traits_detail::dot_kernel>(
+            query, first, static_cast<std::size_t>(last - first), out);
+    }
+    else
+    {
+        for(; first != last; ++first, ++out)
+        {
+            *out = dot(query, *first);
+        }
+    }
+}
+
 
 } // namespace multidim
 } // namespace useful
+
+
+// Make PointType usable wherever point_traits is, without copying it into a
+// supported type. Both must be used at global scope.
+
+// Dimensions are the listed data members, given as member pointers:
+//   USEFUL_MULTIDIM_REGISTER_POINT(pixel, &pixel::r, &pixel::g, &pixel::b)
+#define USEFUL_MULTIDIM_REGISTER_POINT(PointType, ...)                         \
+    namespace useful                                                           \
+    {                                                                          \
+    namespace multidim                                                         \
+    {                                                                          \
+    template <>                                                                \
+    struct point_traits_<PointType, void, void, void>                          \
+        : point_traits_detail::member_traits<PointType, __VA_ARGS__>           \
+    {                                                                          \
+    };                                                                         \
+    }                                                                          \
+    }
+
+// Dimensions are pt[0] to pt[N - 1] of type T, as for fixed size vectors of
+// linear algebra libraries:
+//   USEFUL_MULTIDIM_REGISTER_INDEXED_POINT(Eigen::Vector4f, float, 4)
+#define USEFUL_MULTIDIM_REGISTER_INDEXED_POINT(PointType, T, N)                \
+    namespace useful                                                           \
+    {                                                                          \
+    namespace multidim                                                         \
+    {                                                                          \
+    template <>                                                                \
+    struct point_traits_<PointType, void, void, void>                          \
+        : point_traits_detail::indexed_traits<PointType, T, N>                 \
+    {                                                                          \
+    };                                                                         \
+    }                                                                          \
+    }
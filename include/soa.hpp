@@ -3,6 +3,21 @@
 #include <vector>
 #include <tuple>
 #include <utility>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <functional>
+#include "array_view.hpp"
+#include "parallel_for.hpp"
+
+
+// Lets column kernels tell the compiler that an output column aliases no
+// input column.
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#define USEFUL_RESTRICT __restrict
+#else
+#define USEFUL_RESTRICT
+#endif
 
 
 namespace useful
@@ -27,6 +42,143 @@ using member_type_t =
 template <class MemberPointerType>
 using object_type_t =
     typename deduce_member_pointer<MemberPointerType>::object_type;
+
+// position of MemberRef among MemberRefs, which must contain it
+template <class MemberRef, class... MemberRefs>
+constexpr std::size_t
+member_index()
+{
+    constexpr bool matches[] = {std::is_same<MemberRef, MemberRefs>::value...};
+
+    std::size_t index = 0;
+    while(!matches[index])
+    {
+        ++index;
+    }
+
+    return index;
+}
+
+
+// elements per chunk handed to column kernels, with 64 byte aligned columns
+// every chunk starts aligned
+constexpr std::size_t kernel_chunk = 512;
+// independent accumulators of a reduction, which the compiler can keep in
+// vector registers without reassociating the reduction itself
+constexpr std::size_t reduce_lanes = 8;
+
+struct identity
+{
+    template <class U>
+    U&&
+    operator()(U&& value) const
+    {
+        return std::forward<U>(value);
+    }
+};
+
+// Calls fn(n, columns + first...) for consecutive chunks of Chunk elements
+// of [0, size), the last chunk possibly shorter. Full chunks pass n as
+// std::integral_constant<std::size_t, Chunk>, so a fn taking n as auto gets
+// loops with a fixed trip count; the shorter last chunk passes a size_t.
+template <std::size_t Chunk, class Function, class... Pointers>
+void
+for_each_chunk(std::size_t size, Function& fn, Pointers... columns)
+{
+    std::size_t first = 0;
+    for(; first + Chunk <= size; first += Chunk)
+    {
+        fn(std::integral_constant<std::size_t, Chunk>(),
+           (columns + first)...);
+    }
+
+    if(first < size)
+    {
+        fn(size - first, (columns + first)...);
+    }
+}
+
+// elements per chunk claimed by a thread of a parallel kernel, a multiple
+// of kernel_chunk; as a multiple of 64 every chunk of a column starting on
+// a cache line, as arena_soa's do, spans whole cache lines
+constexpr std::size_t parallel_chunk = 8 * kernel_chunk;
+
+// for_each_chunk<kernel_chunk> over chunks of parallel_chunk elements run by
+// parallel_for
+template <class Function, class... Pointers>
+void
+parallel_for_each_chunk(std::size_t size,
+                        Function& fn,
+                        unsigned threads,
+                        Pointers... columns)
+{
+    parallel_for(
+        size,
+        parallel_chunk,
+        [&](std::size_t first, std::size_t last) {
+            for_each_chunk<kernel_chunk>(
+                last - first, fn, (columns + first)...);
+        },
+        threads);
+}
+
+// Sets member Out of every element of c to fn of its members Ins.
+template <auto Out, auto... Ins, class Container, class Function>
+void
+transform(Container& c, Function& fn)
+{
+    c.template for_each_columns<Out, Ins...>(
+        [&fn](auto n,
+              member_type_t<decltype(Out)>* USEFUL_RESTRICT out,
+              const member_type_t<decltype(Ins)>*... in) {
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                out[i] = fn(in[i]...);
+            }
+        });
+}
+
+// Folds map of the members Members of every element of c into init with op,
+// in reduce_lanes interleaved partial results per chunk.
+template <auto... Members, class Container, class U, class Reduce, class Map>
+U
+reduce(const Container& c, U init, Reduce& op, Map& map)
+{
+    c.template for_each_columns<Members...>(
+        [&](auto n, const member_type_t<decltype(Members)>*... in) {
+            std::size_t i = 0;
+
+            if(n >= reduce_lanes)
+            {
+                U lanes[reduce_lanes];
+                for(std::size_t lane = 0; lane < reduce_lanes; ++lane)
+                {
+                    lanes[lane] = map(in[lane]...);
+                }
+
+                for(i = reduce_lanes; i + reduce_lanes <= n;
+                    i += reduce_lanes)
+                {
+                    for(std::size_t lane = 0; lane < reduce_lanes; ++lane)
+                    {
+                        lanes[lane] = op(lanes[lane], map(in[i + lane]...));
+                    }
+                }
+
+                for(std::size_t lane = 0; lane < reduce_lanes; ++lane)
+                {
+                    init = op(init, lanes[lane]);
+                }
+            }
+
+            for(; i < n; ++i)
+            {
+                init = op(init, map(in[i]...));
+            }
+        });
+
+    return init;
+}
 } // namespace soa_detail
 
 
@@ -40,6 +192,9 @@ struct member_reference
 template <class T, class... MemberRefs>
 class element_proxy;
 
+template <class T, class... MemberRefs>
+class const_element_proxy;
+
 template <class T, class... PointerTypes, PointerTypes... PointerValues>
 class element_proxy<T, member_reference<PointerTypes, PointerValues>...>
 {
@@ -91,12 +246,56 @@ class element_proxy<T, member_reference<PointerTypes, PointerValues>...>
         }
     };
 
+    template <std::size_t... Is>
+    void
+    assign_members(const element_proxy& other, std::index_sequence<Is...>)
+    {
+        ((*std::get<Is>(pointers_) = *std::get<Is>(other.pointers_)), ...);
+    }
+
+    template <std::size_t... Is>
+    static void
+    swap_members(const element_proxy& lhs,
+                 const element_proxy& rhs,
+                 std::index_sequence<Is...>)
+    {
+        using std::swap;
+        (swap(*std::get<Is>(lhs.pointers_), *std::get<Is>(rhs.pointers_)),
+         ...);
+    }
+
 public:
     element_proxy(soa_detail::member_type_t<PointerTypes>&... args)
         : pointers_(&args...)
     {
     }
 
+    element_proxy(const element_proxy&) = default;
+
+    // assigns the referenced members, so that algorithms moving elements
+    // through iterators move the members in every column
+    element_proxy&
+    operator=(const element_proxy& other)
+    {
+        assign_members(other, std::index_sequence_for<PointerTypes...>());
+        return *this;
+    }
+
+    // I-th member of the referenced element
+    template <std::size_t I>
+    auto&
+    get() const
+    {
+        return *std::get<I>(pointers_);
+    }
+
+    // swaps the referenced elements member by member
+    friend void
+    swap(element_proxy lhs, element_proxy rhs)
+    {
+        swap_members(lhs, rhs, std::index_sequence_for<PointerTypes...>());
+    }
+
     operator T() const
     {
         T out{};
@@ -119,6 +318,209 @@ private:
 };
 
 
+// read only counterpart of element_proxy, for const soa
+template <class T, class... PointerTypes, PointerTypes... PointerValues>
+class const_element_proxy<T, member_reference<PointerTypes, PointerValues>...>
+{
+    typedef std::tuple<const soa_detail::member_type_t<PointerTypes>*...>
+        tuple_type;
+
+    template <std::size_t... Is>
+    T
+    make(std::index_sequence<Is...>) const
+    {
+        T out{};
+        ((out.*PointerValues = *std::get<Is>(pointers_)), ...);
+        return out;
+    }
+
+public:
+    const_element_proxy(const soa_detail::member_type_t<PointerTypes>&... args)
+        : pointers_(&args...)
+    {
+    }
+
+    operator T() const
+    {
+        return make(std::index_sequence_for<PointerTypes...>());
+    }
+
+    // I-th member of the referenced element
+    template <std::size_t I>
+    const auto&
+    get() const
+    {
+        return *std::get<I>(pointers_);
+    }
+
+private:
+    tuple_type pointers_;
+};
+
+
+// Random access iterator over a soa, dereferencing to element proxies.
+// Algorithms such as std::sort move and swap whole elements, that is every
+// member column in lockstep, through the proxies.
+template <class SoaType, class ProxyType>
+class soa_iterator
+{
+    template <class OtherSoa, class OtherProxy>
+    friend class soa_iterator;
+
+public:
+    typedef typename std::remove_const_t<SoaType>::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef ProxyType reference;
+    typedef void pointer;
+    typedef std::random_access_iterator_tag iterator_category;
+
+public:
+    soa_iterator() : soa_(nullptr), index_(0)
+    {
+    }
+
+    soa_iterator(SoaType* s, std::size_t index) : soa_(s), index_(index)
+    {
+    }
+
+    // converting constructor primary purpose for conversion to
+    // const_iterator; never from const_iterator to iterator
+    template <class OtherSoa,
+              class OtherProxy,
+              class = std::enable_if_t<
+                  std::is_convertible<OtherSoa*, SoaType*>::value>>
+    soa_iterator(const soa_iterator<OtherSoa, OtherProxy>& other)
+        : soa_(other.soa_), index_(other.index_)
+    {
+    }
+
+    std::size_t
+    index() const
+    {
+        return index_;
+    }
+
+    reference operator*() const
+    {
+        return (*soa_)[index_];
+    }
+
+    reference operator[](difference_type n) const
+    {
+        return (*soa_)[index_ + n];
+    }
+
+    soa_iterator&
+    operator++()
+    {
+        ++index_;
+        return *this;
+    }
+
+    soa_iterator
+    operator++(int)
+    {
+        auto temp = *this;
+        ++(*this);
+        return temp;
+    }
+
+    soa_iterator&
+    operator--()
+    {
+        --index_;
+        return *this;
+    }
+
+    soa_iterator
+    operator--(int)
+    {
+        auto temp = *this;
+        --(*this);
+        return temp;
+    }
+
+    soa_iterator&
+    operator+=(difference_type n)
+    {
+        index_ += n;
+        return *this;
+    }
+
+    soa_iterator&
+    operator-=(difference_type n)
+    {
+        index_ -= n;
+        return *this;
+    }
+
+    friend soa_iterator
+    operator+(soa_iterator it, difference_type n)
+    {
+        return it += n;
+    }
+
+    friend soa_iterator
+    operator+(difference_type n, soa_iterator it)
+    {
+        return it += n;
+    }
+
+    friend soa_iterator
+    operator-(soa_iterator it, difference_type n)
+    {
+        return it -= n;
+    }
+
+    friend difference_type
+    operator-(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return static_cast<difference_type>(lhs.index_) -
+               static_cast<difference_type>(rhs.index_);
+    }
+
+    friend bool
+    operator==(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ == rhs.index_;
+    }
+
+    friend bool
+    operator!=(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ != rhs.index_;
+    }
+
+    friend bool
+    operator<(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ < rhs.index_;
+    }
+
+    friend bool
+    operator>(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ > rhs.index_;
+    }
+
+    friend bool
+    operator<=(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ <= rhs.index_;
+    }
+
+    friend bool
+    operator>=(const soa_iterator& lhs, const soa_iterator& rhs)
+    {
+        return lhs.index_ >= rhs.index_;
+    }
+
+private:
+    SoaType* soa_;
+    std::size_t index_;
+};
+
+
 // helper to access respective parents that are multiply inherited
 template <class FirstParent, class... RestParents>
 struct parent_helper
@@ -218,6 +620,12 @@ public:
     typedef element_proxy<T,
                           member_reference<MemberPtrTypes, MemberPtrValues>...>
         proxy_value_type;
+    typedef const_element_proxy<
+        T,
+        member_reference<MemberPtrTypes, MemberPtrValues>...>
+        const_proxy_value_type;
+    typedef soa_iterator<soa, proxy_value_type> iterator;
+    typedef soa_iterator<const soa, const_proxy_value_type> const_iterator;
 
 public:
     soa() : member_container<MemberPtrTypes, MemberPtrValues>()...
@@ -231,6 +639,48 @@ public:
             member_container<MemberPtrTypes, MemberPtrValues>...>::size(*this);
     }
 
+    bool
+    empty() const
+    {
+        return size() == 0;
+    }
+
+    iterator
+    begin()
+    {
+        return iterator(this, 0);
+    }
+
+    iterator
+    end()
+    {
+        return iterator(this, size());
+    }
+
+    const_iterator
+    begin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    end() const
+    {
+        return const_iterator(this, size());
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator
+    cend() const
+    {
+        return const_iterator(this, size());
+    }
+
     void
     push_back(const T& value)
     {
@@ -252,9 +702,9 @@ public:
             member_container<MemberPtrTypes, MemberPtrValues>::members_[n]...);
     }
 
-    const proxy_value_type operator[](std::size_t n) const
+    const_proxy_value_type operator[](std::size_t n) const
     {
-        return proxy_value_type(
+        return const_proxy_value_type(
             member_container<MemberPtrTypes, MemberPtrValues>::members_[n]...);
     }
 
@@ -272,6 +722,91 @@ public:
         return member_container<MemberPtrType, MemberPtrValue>::members_.data();
     }
 
+    // Calls fn(n, pointers...) with pointers to n consecutive values of each
+    // of Members, for chunks of soa_detail::kernel_chunk elements covering
+    // the soa, the last one possibly shorter. A plain loop over the pointers
+    // in fn can be vectorized, unlike access through element proxies; with n
+    // taken as auto, full chunks pass it as a compile time constant.
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn)
+    {
+        soa_detail::for_each_chunk<soa_detail::kernel_chunk>(
+            size(), fn, data<decltype(Members), Members>()...);
+    }
+
+    template <auto... Members, class Function>
+    void
+    for_each_columns(Function fn) const
+    {
+        soa_detail::for_each_chunk<soa_detail::kernel_chunk>(
+            size(), fn, data<decltype(Members), Members>()...);
+    }
+
+    // Same as for_each_columns with the chunks spread over up to threads
+    // threads, so fn must be safe to call concurrently. Threads claim
+    // soa_detail::parallel_chunk elements at a time, with boundaries
+    // independent of the number of threads. The columns are std::vector
+    // storage without cache line alignment, so the threads of neighbouring
+    // chunks may write to the same cache line at their boundary.
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency())
+    {
+        soa_detail::parallel_for_each_chunk(
+            size(), fn, threads, data<decltype(Members), Members>()...);
+    }
+
+    template <auto... Members, class Function>
+    void
+    parallel_for_each_columns(
+        Function fn,
+        unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        soa_detail::parallel_for_each_chunk(
+            size(), fn, threads, data<decltype(Members), Members>()...);
+    }
+
+    // Sets member Out of every element to fn of its members Ins.
+    template <auto Out, auto... Ins, class Function>
+    void
+    transform(Function fn)
+    {
+        soa_detail::transform<Out, Ins...>(*this, fn);
+    }
+
+    // Folds map of Members of every element into init with op. Elements are
+    // combined in interleaved partial results, so for floating point the
+    // result may differ from a sequential fold by rounding.
+    template <auto... Members,
+              class U,
+              class Reduce = std::plus<>,
+              class Map = soa_detail::identity>
+    U
+    reduce(U init, Reduce op = Reduce(), Map map = Map()) const
+    {
+        return soa_detail::reduce<Members...>(*this, init, op, map);
+    }
+
+    // all values of one member, contiguous
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    array_view<soa_detail::member_type_t<MemberPtrType>>
+    column()
+    {
+        return array_view<soa_detail::member_type_t<MemberPtrType>>(
+            data<MemberPtrType, MemberPtrValue>(), size());
+    }
+
+    template <class MemberPtrType, MemberPtrType MemberPtrValue>
+    array_view<const soa_detail::member_type_t<MemberPtrType>>
+    column() const
+    {
+        return array_view<const soa_detail::member_type_t<MemberPtrType>>(
+            data<MemberPtrType, MemberPtrValue>(), size());
+    }
+
     void
     reserve(std::size_t n)
     {
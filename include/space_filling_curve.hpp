@@ -0,0 +1,425 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+#include <cstdint>
+#include "point_traits.hpp"
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+
+namespace useful
+{
+namespace multidim
+{
+namespace curve_detail
+{
+// positions of the bits of dimension dim in a key interleaving dims
+// dimensions, lowest dimension in the lowest bit
+constexpr std::uint64_t
+interleave_mask(std::size_t dim, std::size_t dims)
+{
+    std::uint64_t out = 0u;
+    for(std::size_t bit = dim; bit < 64; bit += dims)
+    {
+        out |= std::uint64_t(1u) << bit;
+    }
+
+    return out;
+}
+
+// scatters the low bits of value to the set bits of mask, in order
+inline std::uint64_t
+deposit(std::uint64_t value, std::uint64_t mask)
+{
+#if defined(__BMI2__)
+    return _pdep_u64(value, mask);
+#else
+    std::uint64_t out = 0u;
+    for(; mask && value; value >>= 1u)
+    {
+        const std::uint64_t lowest = mask & (~mask + 1u);
+        out |= (value & 1u) ? lowest : 0u;
+        mask ^= lowest;
+    }
+
+    return out;
+#endif
+}
+
+// spreads the low 32 bits of value to the even bits
+inline std::uint64_t
+spread2(std::uint64_t value)
+{
+    value &= 0xffffffffu;
+    value = (value | (value << 16u)) & 0x0000ffff0000ffffu;
+    value = (value | (value << 8u)) & 0x00ff00ff00ff00ffu;
+    value = (value | (value << 4u)) & 0x0f0f0f0f0f0f0f0fu;
+    value = (value | (value << 2u)) & 0x3333333333333333u;
+    value = (value | (value << 1u)) & 0x5555555555555555u;
+
+    return value;
+}
+
+// spreads the low 21 bits of value to every third bit
+inline std::uint64_t
+spread3(std::uint64_t value)
+{
+    value &= 0x1fffffu;
+    value = (value | (value << 32u)) & 0x001f00000000ffffu;
+    value = (value | (value << 16u)) & 0x001f0000ff0000ffu;
+    value = (value | (value << 8u)) & 0x100f00f00f00f00fu;
+    value = (value | (value << 4u)) & 0x10c30c30c30c30c3u;
+    value = (value | (value << 2u)) & 0x1249249249249249u;
+
+    return value;
+}
+} // namespace curve_detail
+
+
+// Number of dimensions and bits per dimension of curve keys for points of
+// PointType. Keys fit 64 bits, dimensions beyond the 64th are ignored.
+template <class PointType>
+struct curve_traits
+{
+    static constexpr std::size_t dimensions =
+        std::min<std::size_t>(point_traits<PointType>::dimensions, 64ul);
+    static constexpr std::size_t bits =
+        std::min<std::size_t>(64ul / dimensions, 32ul);
+};
+
+
+// Z-order key of cells, each below 2^(64 / Dims), interleaving their bits
+// with the bits of cells[0] lowest. Uses BMI2 pdep where available.
+template <std::size_t Dims>
+std::uint64_t
+morton_encode(const std::array<std::uint32_t, Dims>& cells)
+{
+    static_assert(Dims >= 1 && Dims <= 64, "Dims must be in [1, 64]");
+
+#if !defined(__BMI2__)
+    if constexpr(Dims == 2)
+    {
+        return curve_detail::spread2(cells[0]) |
+               curve_detail::spread2(cells[1]) << 1u;
+    }
+    else if constexpr(Dims == 3)
+    {
+        return curve_detail::spread3(cells[0]) |
+               curve_detail::spread3(cells[1]) << 1u |
+               curve_detail::spread3(cells[2]) << 2u;
+    }
+#endif
+
+    std::uint64_t key = 0u;
+    for(std::size_t dim = 0; dim < Dims; ++dim)
+    {
+        key |= curve_detail::deposit(cells[dim],
+                                     curve_detail::interleave_mask(dim, Dims));
+    }
+
+    return key;
+}
+
+// Position along the Hilbert curve through a grid of 2^bits cells per
+// dimension, using Skilling's transform of the cells followed by
+// interleaving. Consecutive keys belong to cells sharing a face, which keeps
+// runs of keys more compact than Z-order does.
+template <std::size_t Dims>
+std::uint64_t
+hilbert_encode(std::array<std::uint32_t, Dims> cells, std::size_t bits)
+{
+    static_assert(Dims >= 1 && Dims <= 64, "Dims must be in [1, 64]");
+
+    const std::uint32_t top = std::uint32_t(1u) << (bits - 1u);
+
+    // undo the rotations and reflections of each level
+    for(std::uint32_t q = top; q > 1u; q >>= 1u)
+    {
+        const std::uint32_t p = q - 1u;
+        for(std::size_t dim = 0; dim < Dims; ++dim)
+        {
+            if(cells[dim] & q)
+            {
+                cells[0] ^= p;
+            }
+            else
+            {
+                const std::uint32_t t = (cells[0] ^ cells[dim]) & p;
+                cells[0] ^= t;
+                cells[dim] ^= t;
+            }
+        }
+    }
+
+    // gray encode
+    for(std::size_t dim = 1; dim < Dims; ++dim)
+    {
+        cells[dim] ^= cells[dim - 1u];
+    }
+
+    std::uint32_t t = 0u;
+    for(std::uint32_t q = top; q > 1u; q >>= 1u)
+    {
+        if(cells[Dims - 1u] & q)
+        {
+            t ^= q - 1u;
+        }
+    }
+
+    for(std::size_t dim = 0; dim < Dims; ++dim)
+    {
+        cells[dim] ^= t;
+    }
+
+    // the first dimension takes the most significant bit of every level
+    std::reverse(cells.begin(), cells.end());
+    return morton_encode(cells);
+}
+
+
+// Maps points inside a bounding box to the cells of a grid with 2^bits cells
+// per dimension, bits as given by curve_traits. Points outside the box are
+// clamped to its border cells.
+template <class PointType>
+class curve_grid
+{
+public:
+    static constexpr std::size_t dimensions =
+        curve_traits<PointType>::dimensions;
+    static constexpr std::size_t bits = curve_traits<PointType>::bits;
+
+    typedef std::array<std::uint32_t, dimensions> cell_type;
+
+    // grid over the bounding box of [first, last), which must not be empty
+    template <class InputIterator>
+    curve_grid(InputIterator first, InputIterator last);
+
+    cell_type cell(const PointType& pt) const;
+
+    std::uint64_t
+    morton_key(const PointType& pt) const
+    {
+        return morton_encode(cell(pt));
+    }
+
+    std::uint64_t
+    hilbert_key(const PointType& pt) const
+    {
+        return hilbert_encode(cell(pt), bits);
+    }
+
+private:
+    std::array<double, dimensions> min_;
+    std::array<double, dimensions> scale_;
+};
+
+
+enum class curve
+{
+    morton,
+    hilbert
+};
+
+
+// Stable ascending sort of [first, last) by the 64 bit keys[i] of each
+// element, with a least significant digit radix sort. Passes over digits
+// that are equal in all keys are skipped. keys is reordered along.
+template <class RandomAccessIterator>
+void radix_sort_by_key(RandomAccessIterator first,
+                       RandomAccessIterator last,
+                       std::vector<std::uint64_t>& keys);
+
+// Positions of the points in [first, last) in the order they are visited by
+// the given curve through their bounding box.
+template <class RandomAccessIterator>
+std::vector<std::size_t> curve_order(RandomAccessIterator first,
+                                     RandomAccessIterator last,
+                                     curve kind = curve::hilbert);
+
+// Reorders the points in [first, last) along the given curve through their
+// bounding box, so points close in space tend to be close in the range.
+template <class RandomAccessIterator>
+void sort_by_curve(RandomAccessIterator first,
+                   RandomAccessIterator last,
+                   curve kind = curve::hilbert);
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType>
+template <class InputIterator>
+curve_grid<PointType>::curve_grid(InputIterator first, InputIterator last)
+{
+    std::array<double, dimensions> max_pt;
+
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        min_[dim] = max_pt[dim] = static_cast<double>(coordinate(*first, dim));
+    }
+
+    for(++first; first != last; ++first)
+    {
+        for(std::size_t dim = 0; dim < dimensions; ++dim)
+        {
+            const double value = static_cast<double>(coordinate(*first, dim));
+            min_[dim] = std::min(min_[dim], value);
+            max_pt[dim] = std::max(max_pt[dim], value);
+        }
+    }
+
+    const double cells = static_cast<double>((std::uint64_t(1u) << bits) - 1u);
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        const double extent = max_pt[dim] - min_[dim];
+        scale_[dim] = extent > 0.0 ? cells / extent : 0.0;
+    }
+}
+
+template <class PointType>
+typename curve_grid<PointType>::cell_type
+curve_grid<PointType>::cell(const PointType& pt) const
+{
+    const double cells = static_cast<double>((std::uint64_t(1u) << bits) - 1u);
+
+    cell_type out;
+    for(std::size_t dim = 0; dim < dimensions; ++dim)
+    {
+        const double value =
+            (static_cast<double>(coordinate(pt, dim)) - min_[dim]) *
+            scale_[dim];
+        out[dim] = static_cast<std::uint32_t>(
+            std::min(std::max(value, 0.0), cells));
+    }
+
+    return out;
+}
+
+template <class RandomAccessIterator>
+void
+radix_sort_by_key(RandomAccessIterator first,
+                  RandomAccessIterator last,
+                  std::vector<std::uint64_t>& keys)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+        value_type;
+
+    const std::size_t n = static_cast<std::size_t>(last - first);
+    if(n < 2ul)
+    {
+        return;
+    }
+
+    // sort positions, then move the elements once
+    std::vector<std::size_t> order(n), next(n);
+    std::vector<std::uint64_t> sorted(n);
+    std::iota(order.begin(), order.end(), 0ul);
+
+    for(unsigned shift = 0u; shift < 64u; shift += 8u)
+    {
+        std::array<std::size_t, 257> counts{};
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            ++counts[((keys[i] >> shift) & 0xffu) + 1u];
+        }
+
+        // every key has the same digit
+        if(std::find(counts.begin() + 1, counts.end(), n) != counts.end())
+        {
+            continue;
+        }
+
+        std::partial_sum(counts.begin(), counts.end(), counts.begin());
+
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            const std::size_t to = counts[(keys[i] >> shift) & 0xffu]++;
+            sorted[to] = keys[i];
+            next[to] = order[i];
+        }
+
+        keys.swap(sorted);
+        order.swap(next);
+    }
+
+    std::vector<value_type> moved;
+    moved.reserve(n);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        moved.push_back(std::move(first[order[i]]));
+    }
+
+    std::move(moved.begin(), moved.end(), first);
+}
+
+template <class RandomAccessIterator>
+std::vector<std::size_t>
+curve_order(RandomAccessIterator first,
+            RandomAccessIterator last,
+            curve kind)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+        point_type;
+
+    const std::size_t n = static_cast<std::size_t>(last - first);
+
+    std::vector<std::size_t> order(n);
+    std::iota(order.begin(), order.end(), 0ul);
+
+    if(n < 2ul)
+    {
+        return order;
+    }
+
+    const curve_grid<point_type> grid(first, last);
+
+    std::vector<std::uint64_t> keys(n);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        keys[i] = kind == curve::morton ? grid.morton_key(first[i])
+                                        : grid.hilbert_key(first[i]);
+    }
+
+    radix_sort_by_key(order.begin(), order.end(), keys);
+
+    return order;
+}
+
+template <class RandomAccessIterator>
+void
+sort_by_curve(RandomAccessIterator first,
+              RandomAccessIterator last,
+              curve kind)
+{
+    typedef typename std::iterator_traits<RandomAccessIterator>::value_type
+        point_type;
+
+    const std::size_t n = static_cast<std::size_t>(last - first);
+    if(n < 2ul)
+    {
+        return;
+    }
+
+    const curve_grid<point_type> grid(first, last);
+
+    std::vector<std::uint64_t> keys(n);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        keys[i] = kind == curve::morton ? grid.morton_key(first[i])
+                                        : grid.hilbert_key(first[i]);
+    }
+
+    radix_sort_by_key(first, last, keys);
+}
+} // namespace multidim
+} // namespace useful
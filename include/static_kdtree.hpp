@@ -0,0 +1,323 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "point_traits.hpp"
+#include "kdtree.hpp"
+
+
+namespace useful
+{
+namespace multidim
+{
+// Immutable kdtree without any per node bookkeeping. Points are stored as a
+// left-balanced tree in breadth first order: the children of the node at
+// index i are found at 2i + 1 and 2i + 2, and the split dimension follows
+// from the depth of a node. The only storage is one PointType per point.
+template <class PointType>
+class static_kdtree
+{
+public:
+    typedef typename std::vector<PointType>::size_type size_type;
+    typedef typename std::vector<PointType>::const_iterator const_iterator;
+    typedef coordinate_type<PointType> distance_type;
+
+private:
+    struct topology
+    {
+        std::pair<size_type, size_type>
+        children(size_type index) const
+        {
+            const size_type smaller = 2ul * index + 1ul;
+            const size_type bigger = smaller + 1ul;
+
+            return {smaller < size ? smaller : 0ul,
+                    bigger < size ? bigger : 0ul};
+        }
+
+        std::size_t
+        split_dimension(size_type, size_type level) const
+        {
+            return level % point_traits<PointType>::dimensions;
+        }
+
+        size_type
+        point(size_type index) const
+        {
+            return index;
+        }
+
+        bool
+        live(size_type) const
+        {
+            return true;
+        }
+
+        size_type
+        bucket(size_type) const
+        {
+            return 0ul;
+        }
+
+        size_type size;
+    };
+
+    template <class Query>
+    void
+    search(Query& query) const
+    {
+        if(!points_.empty())
+        {
+            kdtree_detail::search(
+                points_.data(), topology{points_.size()}, query);
+        }
+    }
+
+    // number of nodes in the smaller subtree of a left-balanced tree of n
+    // nodes
+    static size_type left_size(size_type n);
+
+    void build_helper(std::vector<PointType>& work,
+                      size_type first,
+                      size_type last,
+                      size_type index,
+                      size_type level);
+
+public:
+    static_kdtree() = default;
+
+    template <class InputIterator>
+    static_kdtree(InputIterator first, InputIterator last);
+
+    bool
+    empty() const
+    {
+        return points_.empty();
+    }
+
+    size_type
+    size() const
+    {
+        return points_.size();
+    }
+
+    const_iterator
+    begin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    end() const
+    {
+        return points_.cend();
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return points_.cbegin();
+    }
+
+    const_iterator
+    cend() const
+    {
+        return points_.cend();
+    }
+
+    template <class Metric = squared_euclidean>
+    const_iterator nearest(const PointType& pt,
+                           Metric metric = Metric()) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator k_nearest(const PointType& pt,
+                             size_type k,
+                             OutputIterator out,
+                             Metric metric = Metric()) const;
+
+    template <class Metric = squared_euclidean>
+    void k_nearest(const PointType& pt,
+                   size_type k,
+                   neighbour_heap<distance_type, size_type>& heap,
+                   Metric metric = Metric()) const;
+
+    template <class OutputIterator>
+    OutputIterator range_query(const PointType& min_pt,
+                               const PointType& max_pt,
+                               OutputIterator out) const;
+
+    template <class OutputIterator, class Metric = squared_euclidean>
+    OutputIterator radius_query(const PointType& center,
+                                distance_type r,
+                                OutputIterator out,
+                                Metric metric = Metric()) const;
+
+private:
+    std::vector<PointType> points_;
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace useful
+{
+namespace multidim
+{
+template <class PointType>
+template <class InputIterator>
+static_kdtree<PointType>::static_kdtree(InputIterator first,
+                                        InputIterator last)
+{
+    std::vector<PointType> work(first, last);
+    points_.resize(work.size());
+
+    if(!work.empty())
+    {
+        build_helper(work, 0ul, work.size(), 0ul, 0ul);
+    }
+}
+
+template <class PointType>
+typename static_kdtree<PointType>::size_type
+static_kdtree<PointType>::left_size(size_type n)
+{
+    if(n <= 1ul)
+    {
+        return 0ul;
+    }
+
+    // nodes on the deepest full level
+    size_type full = 1ul;
+    while(2ul * full <= n)
+    {
+        full *= 2ul;
+    }
+
+    // remaining nodes fill the last level from the left
+    const size_type half = full / 2ul;
+    const size_type last_level = n - (full - 1ul);
+
+    return half - 1ul + std::min(last_level, half);
+}
+
+template <class PointType>
+void
+static_kdtree<PointType>::build_helper(std::vector<PointType>& work,
+                                       size_type first,
+                                       size_type last,
+                                       size_type index,
+                                       size_type level)
+{
+    const std::size_t dim = level % point_traits<PointType>::dimensions;
+    const size_type median = first + left_size(last - first);
+
+    std::nth_element(work.begin() + first,
+                     work.begin() + median,
+                     work.begin() + last,
+                     [dim](const PointType& lhs, const PointType& rhs) {
+                         return less(lhs, rhs, dim);
+                     });
+
+    points_[index] = work[median];
+
+    if(first < median)
+    {
+        build_helper(work, first, median, 2ul * index + 1ul, level + 1ul);
+    }
+
+    if(median + 1ul < last)
+    {
+        build_helper(work, median + 1ul, last, 2ul * index + 2ul, level + 1ul);
+    }
+}
+
+template <class PointType>
+template <class Metric>
+typename static_kdtree<PointType>::const_iterator
+static_kdtree<PointType>::nearest(const PointType& pt, Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, 1ul, heap, metric);
+
+    if(heap.empty())
+    {
+        return points_.cend();
+    }
+
+    return points_.cbegin() + heap.begin()->index;
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+static_kdtree<PointType>::k_nearest(const PointType& pt,
+                                    size_type k,
+                                    OutputIterator out,
+                                    Metric metric) const
+{
+    neighbour_heap<distance_type, size_type>& heap =
+        kdtree_detail::scratch_heap<distance_type, size_type>();
+    k_nearest(pt, k, heap, metric);
+    heap.sort();
+
+    for(const auto& neighbour : heap)
+    {
+        *out++ = points_[neighbour.index];
+    }
+
+    return out;
+}
+
+template <class PointType>
+template <class Metric>
+void
+static_kdtree<PointType>::k_nearest(
+    const PointType& pt,
+    size_type k,
+    neighbour_heap<distance_type, size_type>& heap,
+    Metric metric) const
+{
+    heap.reset(k);
+
+    if(k == 0ul)
+    {
+        return;
+    }
+
+    kdtree_detail::nearest_query<PointType, Metric> query{
+        points_.data(), pt, metric, heap};
+    search(query);
+}
+
+template <class PointType>
+template <class OutputIterator>
+OutputIterator
+static_kdtree<PointType>::range_query(const PointType& min_pt,
+                                      const PointType& max_pt,
+                                      OutputIterator out) const
+{
+    kdtree_detail::range_query<PointType, OutputIterator> query{
+        points_.data(), min_pt, max_pt, out};
+    search(query);
+
+    return query.out;
+}
+
+template <class PointType>
+template <class OutputIterator, class Metric>
+OutputIterator
+static_kdtree<PointType>::radius_query(const PointType& center,
+                                       distance_type r,
+                                       OutputIterator out,
+                                       Metric metric) const
+{
+    kdtree_detail::radius_query<PointType, OutputIterator, Metric> query{
+        points_.data(), center, r, metric, out};
+    search(query);
+
+    return query.out;
+}
+} // namespace multidim
+} // namespace useful
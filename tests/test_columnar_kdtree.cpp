@@ -0,0 +1,167 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+#include <catch2/catch.hpp>
+#include <columnar_kdtree.hpp>
+
+
+namespace
+{
+struct sample
+{
+    float x, y, z;
+};
+} // namespace
+
+using useful::multidim::columnar_kdtree;
+
+
+TEST_CASE("query a columnar_kdtree", "[multidim::columnar_kdtree]")
+{
+    std::mt19937 gen(21);
+    std::uniform_real_distribution<float> dist(-50.0f, 50.0f);
+
+    std::vector<sample> points(2000);
+    for(auto& pt : points)
+    {
+        pt = sample{dist(gen), dist(gen), dist(gen)};
+    }
+
+    columnar_kdtree<sample, 16> kdt(points.begin(), points.end());
+
+    REQUIRE(kdt.size() == points.size());
+
+    SECTION("columns mirror the stored points")
+    {
+        auto it = kdt.begin();
+        for(std::size_t i = 0; i < kdt.size(); ++i, ++it)
+        {
+            CHECK(kdt.column(0)[i] == it->x);
+            CHECK(kdt.column(2)[i] == it->z);
+        }
+    }
+
+    SECTION("queries match brute force")
+    {
+        for(int q = 0; q < 25; ++q)
+        {
+            const sample target{dist(gen), dist(gen), dist(gen)};
+
+            std::vector<float> expected;
+            for(const auto& pt : points)
+            {
+                expected.push_back(
+                    useful::multidim::squared_distance(pt, target));
+            }
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<sample> result;
+            kdt.k_nearest(target, 8, std::back_inserter(result));
+
+            REQUIRE(result.size() == 8);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+
+            const float r = 15.0f * 15.0f;
+            std::vector<sample> in_radius;
+            kdt.radius_query(target, r, std::back_inserter(in_radius));
+
+            CHECK(in_radius.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [r](float d) {
+                          return d <= r;
+                      })));
+        }
+
+        std::vector<sample> in_box;
+        kdt.range_query(sample{-10.0f, 0.0f, -40.0f},
+                        sample{25.0f, 30.0f, 0.0f},
+                        std::back_inserter(in_box));
+
+        CHECK(in_box.size() ==
+              static_cast<std::size_t>(
+                  std::count_if(points.begin(), points.end(), [](auto& pt) {
+                      return pt.x >= -10.0f && pt.x <= 25.0f &&
+                             pt.y >= 0.0f && pt.y <= 30.0f &&
+                             pt.z >= -40.0f && pt.z <= 0.0f;
+                  })));
+    }
+
+    SECTION("queries with a non additive metric match brute force")
+    {
+        const useful::multidim::chebyshev metric;
+
+        for(int q = 0; q < 50; ++q)
+        {
+            const sample target{dist(gen), dist(gen), dist(gen)};
+
+            std::vector<float> expected;
+            for(const auto& pt : points)
+            {
+                expected.push_back(metric(pt, target));
+            }
+            std::sort(expected.begin(), expected.end());
+
+            CHECK(metric(*kdt.nearest(target, metric), target) ==
+                  expected.front());
+
+            std::vector<sample> result;
+            kdt.k_nearest(target, 8, std::back_inserter(result), metric);
+
+            REQUIRE(result.size() == 8);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(metric(result[i], target) == expected[i]);
+            }
+
+            const float r = 10.0f;
+            std::vector<sample> in_radius;
+            kdt.radius_query(
+                target, r, std::back_inserter(in_radius), metric);
+
+            CHECK(in_radius.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [r](float d) {
+                          return d <= r;
+                      })));
+        }
+    }
+}
+
+
+TEST_CASE("query a columnar_kdtree of unsigned points",
+          "[multidim::columnar_kdtree]")
+{
+    typedef std::array<unsigned, 2> point;
+
+    std::mt19937 gen(23);
+    std::uniform_int_distribution<unsigned> dist(0u, 1000u);
+
+    std::vector<point> points(500);
+    for(auto& pt : points)
+    {
+        pt = point{dist(gen), dist(gen)};
+    }
+
+    columnar_kdtree<point, 8> kdt(points.begin(), points.end());
+    const useful::multidim::manhattan metric;
+
+    for(int q = 0; q < 100; ++q)
+    {
+        const point target{dist(gen), dist(gen)};
+
+        unsigned expected = metric(points[0], target);
+        for(const auto& pt : points)
+        {
+            expected = std::min(expected, metric(pt, target));
+        }
+
+        CHECK(metric(*kdt.nearest(target, metric), target) == expected);
+    }
+}
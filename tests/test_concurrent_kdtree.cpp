@@ -0,0 +1,106 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iterator>
+
+#include <catch2/catch.hpp>
+#include <concurrent_kdtree.hpp>
+
+
+namespace
+{
+struct sensor
+{
+    float x, y;
+};
+} // namespace
+
+using useful::multidim::concurrent_kdtree;
+
+
+TEST_CASE("single writer publishes to readers",
+          "[multidim::concurrent_kdtree]")
+{
+    std::vector<sensor> initial{{0.0f, 0.0f}, {10.0f, 10.0f}};
+    concurrent_kdtree<sensor> tree(initial.begin(), initial.end());
+
+    CHECK(tree.read()->size() == 2);
+
+    SECTION("inserts are invisible until published")
+    {
+        tree.insert(sensor{5.0f, 5.0f});
+
+        CHECK(tree.pending() == 1);
+        CHECK(tree.read()->size() == 2);
+
+        tree.publish();
+
+        CHECK(tree.pending() == 0);
+        CHECK(tree.read()->size() == 3);
+
+        tree.insert(sensor{6.0f, 6.0f});
+        tree.publish();
+
+        const auto r = tree.read();
+        CHECK(r->size() == 4);
+        CHECK(r->nearest(sensor{6.1f, 6.1f})->x == Approx(6.0f));
+    }
+
+    SECTION("a pinned tree does not change")
+    {
+        const auto pinned = tree.read();
+
+        tree.insert(sensor{1.0f, 1.0f});
+        tree.publish();
+
+        CHECK(pinned->size() == 2);
+        CHECK(tree.read()->size() == 3);
+    }
+
+    SECTION("readers run concurrently with the writer")
+    {
+        std::atomic<bool> done{false};
+        std::atomic<int> failures{0};
+
+        std::vector<std::thread> readers;
+        for(int t = 0; t < 4; ++t)
+        {
+            readers.emplace_back([&] {
+                std::size_t last_size = 0;
+                while(!done)
+                {
+                    const auto r = tree.read();
+                    const std::size_t size = r->size();
+
+                    std::vector<sensor> found;
+                    r->k_nearest(
+                        sensor{0.0f, 0.0f}, size, std::back_inserter(found));
+
+                    if(size < last_size || found.size() != size)
+                    {
+                        ++failures;
+                    }
+                    last_size = size;
+                }
+            });
+        }
+
+        for(int i = 0; i < 200; ++i)
+        {
+            tree.insert(sensor{float(i), float(-i)});
+            if(i % 10 == 9)
+            {
+                tree.publish();
+            }
+        }
+
+        done = true;
+        for(auto& reader : readers)
+        {
+            reader.join();
+        }
+
+        CHECK(failures == 0);
+        CHECK(tree.read()->size() == 202);
+    }
+}
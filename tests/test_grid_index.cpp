@@ -0,0 +1,278 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include <catch2/catch.hpp>
+#include <grid_index.hpp>
+
+
+namespace
+{
+template <std::size_t Dims>
+std::vector<std::array<float, Dims>>
+random_points(std::size_t n, float low, float high, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(low, high);
+
+    std::vector<std::array<float, Dims>> out(n);
+    for(auto& pt : out)
+    {
+        for(float& value : pt)
+        {
+            value = dist(gen);
+        }
+    }
+
+    return out;
+}
+
+template <class PointType, class Metric>
+std::vector<float>
+brute_force_distances(const std::vector<PointType>& points,
+                      const PointType& target,
+                      std::size_t k,
+                      Metric metric)
+{
+    std::vector<float> distances;
+    for(const auto& pt : points)
+    {
+        distances.push_back(metric(pt, target));
+    }
+
+    std::sort(distances.begin(), distances.end());
+    distances.resize(std::min(k, distances.size()));
+    return distances;
+}
+} // namespace
+
+using useful::multidim::grid_index;
+using useful::multidim::manhattan;
+using useful::multidim::squared_euclidean;
+
+
+TEST_CASE("construct a grid_index", "[multidim::grid_index]")
+{
+    typedef std::array<float, 2> point;
+
+    SECTION("cell size must be positive")
+    {
+        CHECK_THROWS_AS(grid_index<point>(0.0), std::runtime_error);
+        CHECK_THROWS_AS(grid_index<point>(-1.0), std::runtime_error);
+    }
+
+    SECTION("empty")
+    {
+        grid_index<point> grid(1.0);
+
+        CHECK(grid.empty());
+        CHECK(grid.bucket_count() == 0);
+
+        std::vector<point> out;
+        grid.k_nearest(point{}, 3, std::back_inserter(out));
+        grid.radius_query(point{}, 10.0f, std::back_inserter(out));
+        CHECK(out.empty());
+    }
+
+    SECTION("points are stored by bucket and map back to their source")
+    {
+        const auto points = random_points<2>(1000, -50.0f, 50.0f, 3);
+        grid_index<point> grid(points.begin(), points.end(), 2.0);
+
+        REQUIRE(grid.size() == points.size());
+        CHECK_FALSE(grid.hashed());
+
+        for(std::size_t i = 0; i < grid.size(); ++i)
+        {
+            CHECK(grid.cbegin()[i] == points[grid.source_index(i)]);
+        }
+
+        CHECK(std::is_permutation(
+            grid.cbegin(), grid.cend(), points.begin(), points.end()));
+    }
+
+    SECTION("cells are floored")
+    {
+        grid_index<point> grid(0.5);
+
+        const auto c = grid.cell(point{-0.25f, 1.75f});
+        CHECK(c[0] == -1);
+        CHECK(c[1] == 3);
+    }
+}
+
+
+TEST_CASE("query a grid_index", "[multidim::grid_index]")
+{
+    typedef std::array<float, 3> point;
+
+    auto points = random_points<3>(5000, -10.0f, 10.0f, 5);
+    // includes targets outside the occupied cells
+    auto targets = random_points<3>(50, -15.0f, 15.0f, 7);
+
+    const bool clustered = GENERATE(false, true);
+    if(clustered)
+    {
+        // too many empty cells between the clusters for a dense grid
+        for(std::size_t i = 0; i < points.size(); i += 2)
+        {
+            points[i][0] += 1000.0f;
+        }
+
+        for(std::size_t i = 0; i < targets.size(); i += 2)
+        {
+            targets[i][0] += 1000.0f;
+        }
+    }
+
+    grid_index<point> grid(points.begin(), points.end(), 1.0);
+    CHECK(grid.hashed() == clustered);
+
+    SECTION("k nearest")
+    {
+        for(std::size_t k : {1ul, 10ul, 100ul})
+        {
+            for(const auto& target : targets)
+            {
+                const auto expected = brute_force_distances(
+                    points, target, k, squared_euclidean());
+
+                std::vector<point> found;
+                grid.k_nearest(target, k, std::back_inserter(found));
+
+                REQUIRE(found.size() == expected.size());
+                for(std::size_t i = 0; i < found.size(); ++i)
+                {
+                    CHECK(squared_euclidean()(found[i], target) ==
+                          Approx(expected[i]));
+                }
+            }
+        }
+    }
+
+    SECTION("k nearest with another metric")
+    {
+        for(const auto& target : targets)
+        {
+            const auto expected =
+                brute_force_distances(points, target, 10, manhattan());
+
+            std::vector<point> found;
+            grid.k_nearest(
+                target, 10, std::back_inserter(found), manhattan());
+
+            REQUIRE(found.size() == expected.size());
+            for(std::size_t i = 0; i < found.size(); ++i)
+            {
+                CHECK(manhattan()(found[i], target) == Approx(expected[i]));
+            }
+        }
+    }
+
+    SECTION("more neighbours than points")
+    {
+        std::vector<point> found;
+        grid.k_nearest(targets[0], 6000, std::back_inserter(found));
+        CHECK(found.size() == points.size());
+    }
+
+    SECTION("radius")
+    {
+        for(float r : {0.5f, 2.0f, 9.0f})
+        {
+            for(const auto& target : targets)
+            {
+                std::vector<point> expected;
+                std::copy_if(points.begin(),
+                             points.end(),
+                             std::back_inserter(expected),
+                             [&](const point& pt) {
+                                 return squared_euclidean()(pt, target) <= r;
+                             });
+
+                std::vector<point> found;
+                grid.radius_query(target, r, std::back_inserter(found));
+
+                CHECK(found.size() == expected.size());
+                CHECK(std::is_permutation(found.begin(),
+                                          found.end(),
+                                          expected.begin(),
+                                          expected.end()));
+            }
+        }
+    }
+
+    SECTION("rebuild with moved points")
+    {
+        auto moved = points;
+        for(auto& pt : moved)
+        {
+            pt[0] += 100.0f;
+        }
+
+        grid.rebuild(moved.begin(), moved.end());
+        REQUIRE(grid.size() == moved.size());
+
+        for(const auto& target : targets)
+        {
+            point shifted = target;
+            shifted[0] += 100.0f;
+
+            const auto expected =
+                brute_force_distances(moved, shifted, 5, squared_euclidean());
+
+            std::vector<point> found;
+            grid.k_nearest(shifted, 5, std::back_inserter(found));
+
+            REQUIRE(found.size() == expected.size());
+            for(std::size_t i = 0; i < found.size(); ++i)
+            {
+                CHECK(squared_euclidean()(found[i], shifted) ==
+                      Approx(expected[i]));
+            }
+        }
+    }
+}
+
+
+TEST_CASE("query a sparse grid_index", "[multidim::grid_index]")
+{
+    typedef std::array<float, 3> point;
+
+    // a small cluster and a far outlier span a box of about 10^16 cells
+    auto points = random_points<3>(100, 0.0f, 1.0f, 11);
+    points.push_back(point{1e4f, 1e4f, 1e4f});
+
+    grid_index<point> grid(points.begin(), points.end(), 0.05);
+    REQUIRE(grid.hashed());
+
+    const point target{0.5f, 0.5f, 0.5f};
+
+    SECTION("k nearest reaching the outlier")
+    {
+        const auto expected =
+            brute_force_distances(points, target, 101, squared_euclidean());
+
+        std::vector<point> found;
+        grid.k_nearest(target, 101, std::back_inserter(found));
+
+        REQUIRE(found.size() == expected.size());
+        for(std::size_t i = 0; i < found.size(); ++i)
+        {
+            CHECK(squared_euclidean()(found[i], target) ==
+                  Approx(expected[i]));
+        }
+    }
+
+    SECTION("radius reaching the outlier")
+    {
+        std::vector<point> found;
+        grid.radius_query(target, 1e9f, std::back_inserter(found));
+
+        CHECK(std::is_permutation(
+            found.begin(), found.end(), points.begin(), points.end()));
+    }
+}
@@ -0,0 +1,48 @@
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <handle_map.hpp>
+
+
+TEST_CASE("erase from a handle_map", "[handle_map]")
+{
+    useful::handle_map<int> map;
+    std::vector<useful::handle_map<int>::handle_type> handles;
+    for(int i = 0; i < 100; ++i)
+    {
+        handles.push_back(map.insert(i));
+    }
+
+    SECTION("handles stay valid after erasing out of dense order")
+    {
+        // every erase moves the dense back into the erased slot, so later
+        // erases hit elements no longer at the position of their handle
+        for(std::size_t i = 0; i < handles.size(); i += 3)
+        {
+            map.erase(handles[i]);
+        }
+        for(std::size_t i = 1; i < handles.size(); i += 3)
+        {
+            map.erase(handles[i]);
+        }
+
+        REQUIRE(map.size() == 33);
+        for(std::size_t i = 2; i < handles.size(); i += 3)
+        {
+            CHECK(map[handles[i]] == int(i));
+        }
+    }
+
+    SECTION("freed handles are reused")
+    {
+        map.erase(handles[10]);
+        map.erase(handles[90]);
+
+        const auto a = map.insert(-1);
+        const auto b = map.insert(-2);
+        CHECK(map[a] == -1);
+        CHECK(map[b] == -2);
+        CHECK(map[handles[50]] == 50);
+        CHECK(map.size() == 100);
+    }
+}
@@ -1,3 +1,11 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
 #include <catch2/catch.hpp>
 #include <kdtree.hpp>
 
@@ -64,3 +72,1046 @@ TEST_CASE("default construct a kdtree", "[multidim::kdtree]")
         }
     }
 }
+
+
+namespace
+{
+std::vector<point_type>
+random_points(std::size_t n, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+
+    std::vector<point_type> out(n);
+    for(auto& pt : out)
+    {
+        pt = point_type{dist(gen), dist(gen)};
+    }
+
+    return out;
+}
+
+std::vector<float>
+brute_force_distances(const std::vector<point_type>& points,
+                      const point_type& target)
+{
+    std::vector<float> out;
+    for(const auto& pt : points)
+    {
+        out.push_back(useful::multidim::squared_distance(pt, target));
+    }
+    std::sort(out.begin(), out.end());
+
+    return out;
+}
+} // namespace
+
+
+TEST_CASE("nearest neighbour queries", "[multidim::kdtree]")
+{
+    kdtree<point_type> kdt;
+
+    CHECK(kdt.nearest(point_type{0.0f, 0.0f}) == kdt.cend());
+
+    const auto points = random_points(500, 42);
+    for(const auto& pt : points)
+    {
+        kdt.insert(pt);
+    }
+
+    const auto targets = random_points(50, 7);
+
+    SECTION("nearest matches brute force")
+    {
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target);
+            const auto it = kdt.nearest(target);
+
+            REQUIRE(it != kdt.cend());
+            CHECK(useful::multidim::squared_distance(*it, target) ==
+                  Approx(expected.front()));
+        }
+    }
+
+    SECTION("k nearest are sorted and match brute force")
+    {
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target);
+
+            std::vector<point_type> result;
+            kdt.k_nearest(target, 10, std::back_inserter(result));
+
+            REQUIRE(result.size() == 10);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+        }
+    }
+
+    SECTION("k larger than size returns every point")
+    {
+        std::vector<point_type> result;
+        kdt.k_nearest(point_type{0.0f, 0.0f}, 1000, std::back_inserter(result));
+
+        CHECK(result.size() == points.size());
+    }
+}
+
+
+TEST_CASE("queries with other metrics", "[multidim::kdtree]")
+{
+    const auto points = random_points(2000, 89);
+    kdtree<point_type> kdt(points.begin(), points.end());
+
+    const auto check = [&](auto metric) {
+        for(const auto& target : random_points(20, 97))
+        {
+            std::vector<float> expected;
+            for(const auto& pt : points)
+            {
+                expected.push_back(metric(pt, target));
+            }
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<point_type> result;
+            kdt.k_nearest(target, 5, std::back_inserter(result), metric);
+
+            REQUIRE(result.size() == 5);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(metric(result[i], target) == Approx(expected[i]));
+            }
+
+            std::vector<point_type> within;
+            kdt.radius_query(target, 30.0f, std::back_inserter(within), metric);
+            CHECK(within.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [](float d) {
+                          return d <= 30.0f;
+                      })));
+        }
+    };
+
+    SECTION("manhattan")
+    {
+        check(useful::multidim::manhattan());
+    }
+
+    SECTION("chebyshev")
+    {
+        check(useful::multidim::chebyshev());
+    }
+}
+
+
+TEST_CASE("range and radius queries", "[multidim::kdtree]")
+{
+    kdtree<point_type> kdt;
+
+    const auto points = random_points(500, 3);
+    for(const auto& pt : points)
+    {
+        kdt.insert(pt);
+    }
+
+    SECTION("box query matches brute force")
+    {
+        const point_type min_pt{-20.0f, 10.0f};
+        const point_type max_pt{30.0f, 60.0f};
+
+        std::vector<point_type> result;
+        kdt.range_query(min_pt, max_pt, std::back_inserter(result));
+
+        const auto expected =
+            std::count_if(points.begin(), points.end(), [&](const auto& pt) {
+                return pt.x >= min_pt.x && pt.x <= max_pt.x &&
+                       pt.y >= min_pt.y && pt.y <= max_pt.y;
+            });
+
+        CHECK(result.size() == static_cast<std::size_t>(expected));
+        for(const auto& pt : result)
+        {
+            CHECK(pt.x >= min_pt.x);
+            CHECK(pt.x <= max_pt.x);
+            CHECK(pt.y >= min_pt.y);
+            CHECK(pt.y <= max_pt.y);
+        }
+    }
+
+    SECTION("radius query matches brute force")
+    {
+        const point_type center{5.0f, -5.0f};
+        const float r = 25.0f * 25.0f;
+
+        std::vector<point_type> result;
+        kdt.radius_query(center, r, std::back_inserter(result));
+
+        const auto expected =
+            std::count_if(points.begin(), points.end(), [&](const auto& pt) {
+                return useful::multidim::squared_distance(pt, center) <= r;
+            });
+
+        CHECK(result.size() == static_cast<std::size_t>(expected));
+        for(const auto& pt : result)
+        {
+            CHECK(useful::multidim::squared_distance(pt, center) <= r);
+        }
+    }
+}
+
+
+TEST_CASE("bulk build a balanced kdtree", "[multidim::kdtree]")
+{
+    SECTION("empty range")
+    {
+        std::vector<point_type> none;
+        kdtree<point_type> kdt(none.begin(), none.end());
+
+        CHECK(kdt.empty());
+        CHECK(kdt.depth_begin() == kdt.depth_end());
+    }
+
+    SECTION("sorted input")
+    {
+        std::vector<point_type> points;
+        for(int i = 0; i < 1000; ++i)
+        {
+            points.push_back(point_type{float(i), float(i % 17)});
+        }
+
+        kdtree<point_type> kdt(points.begin(), points.end());
+
+        CHECK(kdt.size() == points.size());
+        std::size_t visited = 0;
+        for(auto it = kdt.depth_begin(); it != kdt.depth_end(); ++it)
+        {
+            ++visited;
+        }
+        CHECK(visited == 1000);
+
+        std::vector<point_type> result;
+        kdt.range_query(point_type{100.0f, 0.0f},
+                        point_type{199.0f, 16.0f},
+                        std::back_inserter(result));
+        CHECK(result.size() == 100);
+
+        const auto it = kdt.nearest(point_type{500.2f, 7.0f});
+        CHECK(it->x == Approx(500.0f));
+    }
+
+    SECTION("random input matches brute force")
+    {
+        const auto points = random_points(777, 11);
+        kdtree<point_type> kdt;
+        kdt.insert(point_type{1000.0f, 1000.0f});
+        kdt.build(points.begin(), points.end());
+
+        CHECK(kdt.size() == points.size());
+
+        for(const auto& target : random_points(20, 5))
+        {
+            const auto expected = brute_force_distances(points, target);
+
+            std::vector<point_type> result;
+            kdt.k_nearest(target, 5, std::back_inserter(result));
+
+            REQUIRE(result.size() == 5);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+        }
+    }
+}
+
+
+TEST_CASE("parallel bulk build", "[multidim::kdtree]")
+{
+    const auto points = random_points(100000, 13);
+
+    kdtree<point_type> serial(points.begin(), points.end());
+    kdtree<point_type> parallel(points.begin(), points.end(), 4u);
+
+    REQUIRE(parallel.size() == serial.size());
+
+    SECTION("layout does not depend on thread count")
+    {
+        CHECK(std::equal(serial.cbegin(),
+                         serial.cend(),
+                         parallel.cbegin(),
+                         [](const point_type& lhs, const point_type& rhs) {
+                             return lhs.x == rhs.x && lhs.y == rhs.y;
+                         }));
+    }
+
+    SECTION("queries match brute force")
+    {
+        for(const auto& target : random_points(10, 17))
+        {
+            const auto expected = brute_force_distances(points, target);
+            const auto it = parallel.nearest(target);
+
+            CHECK(useful::multidim::squared_distance(*it, target) ==
+                  Approx(expected.front()));
+        }
+    }
+}
+
+
+TEST_CASE("batched k nearest queries", "[multidim::kdtree]")
+{
+    const auto points = random_points(5000, 23);
+    const auto queries = random_points(300, 29);
+    const std::size_t k = 6;
+
+    kdtree<point_type> kdt(points.begin(), points.end());
+
+    std::vector<point_type> expected;
+    for(const auto& query : queries)
+    {
+        kdt.k_nearest(query, k, std::back_inserter(expected));
+    }
+
+    const auto same = [](const point_type& lhs, const point_type& rhs) {
+        return lhs.x == rhs.x && lhs.y == rhs.y;
+    };
+
+    SECTION("single thread in query order")
+    {
+        std::vector<point_type> result(queries.size() * k);
+        kdt.k_nearest_batch(
+            queries.begin(), queries.end(), k, result.begin(), 1u, false);
+
+        CHECK(std::equal(
+            result.begin(), result.end(), expected.begin(), same));
+    }
+
+    SECTION("several threads in spatial order")
+    {
+        std::vector<point_type> result(queries.size() * k);
+        kdt.k_nearest_batch(
+            queries.begin(), queries.end(), k, result.begin(), 4u, true);
+
+        CHECK(std::equal(
+            result.begin(), result.end(), expected.begin(), same));
+    }
+
+    SECTION("fewer points than neighbours leave rows short")
+    {
+        const point_type unset{1000.0f, 1000.0f};
+        kdtree<point_type> small(points.begin(), points.begin() + 4);
+
+        std::vector<point_type> result(queries.size() * k, unset);
+        small.k_nearest_batch(
+            queries.begin(), queries.end(), k, result.begin(), 2u);
+
+        for(std::size_t i = 0; i < queries.size(); ++i)
+        {
+            std::vector<point_type> row;
+            small.k_nearest(queries[i], k, std::back_inserter(row));
+            REQUIRE(row.size() == 4);
+
+            const auto first = result.begin() + i * k;
+            CHECK(std::equal(row.begin(), row.end(), first, same));
+            CHECK(same(first[4], unset));
+            CHECK(same(first[5], unset));
+        }
+    }
+}
+
+
+TEST_CASE("erase points from a kdtree", "[multidim::kdtree]")
+{
+    auto points = random_points(2000, 31);
+    kdtree<point_type> kdt(points.begin(), points.end());
+
+    const auto find = [&kdt](const point_type& pt) {
+        return std::find_if(kdt.cbegin(), kdt.cend(), [&pt](const auto& p) {
+            return p.x == pt.x && p.y == pt.y;
+        });
+    };
+
+    SECTION("erase every point")
+    {
+        for(const auto& pt : points)
+        {
+            kdt.erase(find(pt));
+        }
+
+        CHECK(kdt.empty());
+        CHECK(kdt.size() == 0);
+        CHECK(kdt.depth_begin() == kdt.depth_end());
+    }
+
+    SECTION("queries ignore erased points")
+    {
+        kdt.max_erased_ratio(0.9);
+
+        std::mt19937 gen(3);
+        std::shuffle(points.begin(), points.end(), gen);
+
+        const std::vector<point_type> kept(points.begin() + 1200,
+                                           points.end());
+        for(auto it = points.begin(); it != points.begin() + 1200; ++it)
+        {
+            kdt.erase(find(*it));
+            REQUIRE(kdt.size() ==
+                    static_cast<std::size_t>(points.end() - it - 1));
+        }
+
+        std::size_t live = 0;
+        for(auto it = kdt.depth_begin(); it != kdt.depth_end(); ++it)
+        {
+            ++live;
+        }
+        CHECK(live == kept.size());
+
+        for(const auto& target : random_points(20, 37))
+        {
+            const auto expected = brute_force_distances(kept, target);
+
+            std::vector<point_type> result;
+            kdt.k_nearest(target, 3, std::back_inserter(result));
+
+            REQUIRE(result.size() == 3);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+        }
+
+        SECTION("rebuild drops erased points")
+        {
+            kdt.rebuild();
+
+            CHECK(kdt.size() == kept.size());
+            CHECK(std::distance(kdt.cbegin(), kdt.cend()) ==
+                  static_cast<std::ptrdiff_t>(kept.size()));
+        }
+    }
+
+    SECTION("erased ratio triggers a rebuild")
+    {
+        for(std::size_t i = 0; i < 1000; ++i)
+        {
+            kdt.erase(find(points[i]));
+        }
+
+        CHECK(kdt.size() == 1000);
+        CHECK(std::distance(kdt.cbegin(), kdt.cend()) <= 1250);
+    }
+
+    SECTION("rebuilds stay in the subtrees holding erased points")
+    {
+        // low enough for the erased points to exceed it in the whole tree
+        kdt.max_erased_ratio(0.005);
+
+        const std::vector<point_type> before(kdt.cbegin(), kdt.cend());
+
+        std::size_t erased = 0;
+        for(const auto& pt : points)
+        {
+            if(pt.x < -80.0f)
+            {
+                kdt.erase(find(pt));
+                ++erased;
+            }
+        }
+
+        REQUIRE(kdt.size() == points.size() - erased);
+
+        std::size_t tombstones = 0;
+        for(auto it = kdt.cbegin(); it != kdt.cend(); ++it)
+        {
+            tombstones += kdt.erased(it) ? 1ul : 0ul;
+        }
+        CHECK(tombstones <= 10);
+
+        // rebuilding the whole tree would move nearly every point
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < 1000; ++i)
+        {
+            kept += kdt.cbegin()[i].x == before[i].x ? 1ul : 0ul;
+        }
+        CHECK(kept > 500);
+    }
+
+    SECTION("erasing an erased point does nothing")
+    {
+        kdt.max_erased_ratio(0.9);
+        kdt.erase(kdt.cbegin());
+        REQUIRE(kdt.erased(kdt.cbegin()));
+
+        const auto slots = std::distance(kdt.cbegin(), kdt.cend());
+        for(int i = 0; i < 10; ++i)
+        {
+            kdt.erase(kdt.cbegin());
+        }
+
+        CHECK(kdt.size() == points.size() - 1);
+        CHECK(std::distance(kdt.cbegin(), kdt.cend()) == slots);
+    }
+}
+
+
+TEST_CASE("incremental inserts stay balanced", "[multidim::kdtree]")
+{
+    kdtree<point_type> kdt;
+
+    std::vector<point_type> points;
+    for(int i = 0; i < 10000; ++i)
+    {
+        points.push_back(point_type{float(i), float(i)});
+        kdt.insert(points.back());
+    }
+
+    CHECK(kdt.size() == points.size());
+    CHECK(kdt.height() < 64);
+
+    for(const auto& target : random_points(20, 41))
+    {
+        const auto expected = brute_force_distances(points, target);
+        const auto it = kdt.nearest(target);
+
+        CHECK(useful::multidim::squared_distance(*it, target) ==
+              Approx(expected.front()));
+    }
+}
+
+
+namespace
+{
+struct fragile_point
+{
+    float x, y;
+
+    // makes the next copy throw
+    static inline bool fail = false;
+
+    fragile_point(float x_, float y_) : x(x_), y(y_)
+    {
+    }
+
+    fragile_point(const fragile_point& other) : x(other.x), y(other.y)
+    {
+        if(fail)
+        {
+            fail = false;
+            throw std::runtime_error("copy failed");
+        }
+    }
+
+    fragile_point& operator=(const fragile_point&) = default;
+};
+} // namespace
+
+
+TEST_CASE("a throwing insert leaves the kdtree unchanged",
+          "[multidim::kdtree]")
+{
+    kdtree<fragile_point, 4> kdt;
+    std::vector<point_type> inserted;
+    for(const auto& pt : random_points(200, 107))
+    {
+        kdt.insert(fragile_point(pt.x, pt.y));
+        inserted.push_back(pt);
+    }
+
+    const auto check_queries = [&]() {
+        REQUIRE(kdt.size() == inserted.size());
+
+        std::vector<fragile_point> result;
+        kdt.range_query(fragile_point(-100.0f, -100.0f),
+                        fragile_point(100.0f, 100.0f),
+                        std::back_inserter(result));
+        CHECK(result.size() == inserted.size());
+
+        for(const auto& target : random_points(10, 109))
+        {
+            const auto expected = brute_force_distances(inserted, target);
+
+            result.clear();
+            kdt.k_nearest(fragile_point(target.x, target.y),
+                          3,
+                          std::back_inserter(result));
+            REQUIRE(result.size() == 3);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                const point_type found{result[i].x, result[i].y};
+                CHECK(useful::multidim::squared_distance(found, target) ==
+                      Approx(expected[i]));
+            }
+        }
+    };
+
+    const fragile_point extra(1.0f, 2.0f);
+    fragile_point::fail = true;
+    CHECK_THROWS_AS(kdt.insert(extra), std::runtime_error);
+    REQUIRE_FALSE(fragile_point::fail);
+    check_queries();
+
+    kdt.insert(fragile_point(-1.0f, -2.0f));
+    inserted.push_back(point_type{-1.0f, -2.0f});
+    check_queries();
+}
+
+
+TEST_CASE("insert a range of points", "[multidim::kdtree]")
+{
+    const auto first_half = random_points(1000, 43);
+    const auto second_half = random_points(1000, 47);
+
+    kdtree<point_type> kdt;
+    kdt.insert(first_half.begin(), first_half.end());
+    kdt.insert(second_half.begin(), second_half.end());
+
+    CHECK(kdt.size() == 2000);
+
+    std::vector<point_type> points(first_half);
+    points.insert(points.end(), second_half.begin(), second_half.end());
+
+    for(const auto& target : random_points(20, 53))
+    {
+        const auto expected = brute_force_distances(points, target);
+        const auto it = kdt.nearest(target);
+
+        CHECK(useful::multidim::squared_distance(*it, target) ==
+              Approx(expected.front()));
+    }
+}
+
+
+TEST_CASE("approximate nearest neighbour queries", "[multidim::kdtree]")
+{
+    const auto points = random_points(5000, 61);
+    kdtree<point_type> kdt(points.begin(), points.end());
+
+    const auto targets = random_points(30, 67);
+
+    SECTION("without slack or visit limit the result is exact")
+    {
+        for(const auto& target : targets)
+        {
+            std::vector<point_type> exact, approx;
+            kdt.k_nearest(target, 5, std::back_inserter(exact));
+            kdt.approximate_k_nearest(
+                target, 5, std::back_inserter(approx), 0.0);
+
+            REQUIRE(approx.size() == exact.size());
+            for(std::size_t i = 0; i < exact.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(approx[i], target) ==
+                      Approx(useful::multidim::squared_distance(exact[i],
+                                                                target)));
+            }
+        }
+    }
+
+    SECTION("slack bounds the error")
+    {
+        const double eps = 0.5;
+        for(const auto& target : targets)
+        {
+            const auto exact = *kdt.nearest(target);
+
+            std::vector<point_type> approx;
+            kdt.approximate_k_nearest(
+                target, 1, std::back_inserter(approx), eps);
+
+            REQUIRE(approx.size() == 1);
+            CHECK(useful::multidim::squared_distance(approx[0], target) <=
+                  (1.0 + eps) *
+                          useful::multidim::squared_distance(exact, target) +
+                      1e-4);
+        }
+    }
+
+    SECTION("slack applies to integer coordinates")
+    {
+        typedef std::array<int, 2> int_point;
+
+        std::mt19937 gen(63);
+        std::uniform_int_distribution<int> dist(-1000, 1000);
+
+        std::vector<int_point> int_points(5000);
+        for(auto& pt : int_points)
+        {
+            pt = int_point{dist(gen), dist(gen)};
+        }
+
+        kdtree<int_point> int_kdt(int_points.begin(), int_points.end());
+
+        const double eps = 0.5;
+        std::size_t inexact = 0;
+        for(int q = 0; q < 200; ++q)
+        {
+            const int_point target{dist(gen), dist(gen)};
+            const int exact =
+                useful::multidim::squared_distance(*int_kdt.nearest(target),
+                                                   target);
+
+            std::vector<int_point> approx;
+            int_kdt.approximate_k_nearest(
+                target, 1, std::back_inserter(approx), eps);
+
+            REQUIRE(approx.size() == 1);
+            const int found =
+                useful::multidim::squared_distance(approx[0], target);
+            CHECK(found <= (1.0 + eps) * exact);
+            inexact += found != exact ? 1ul : 0ul;
+        }
+
+        // a scale truncated to 1 would make every query exact
+        CHECK(inexact > 0);
+    }
+
+    SECTION("visit limit still fills the result")
+    {
+        for(const auto& target : targets)
+        {
+            std::vector<point_type> approx;
+            kdt.approximate_k_nearest(
+                target, 4, std::back_inserter(approx), 0.0, 40);
+
+            CHECK(approx.size() == 4);
+            CHECK(std::is_sorted(
+                approx.begin(),
+                approx.end(),
+                [&target](const point_type& lhs, const point_type& rhs) {
+                    return useful::multidim::squared_distance(lhs, target) <
+                           useful::multidim::squared_distance(rhs, target);
+                }));
+        }
+    }
+}
+
+
+TEST_CASE("kdtree with leaf buckets", "[multidim::kdtree]")
+{
+    auto points = random_points(3000, 71);
+    kdtree<point_type, 16> kdt(points.begin(), points.end());
+
+    const auto targets = random_points(25, 73);
+
+    const auto check_queries = [&]() {
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target);
+
+            std::vector<point_type> result;
+            kdt.k_nearest(target, 8, std::back_inserter(result));
+
+            REQUIRE(result.size() == 8);
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+
+            result.clear();
+            kdt.approximate_k_nearest(
+                target, 8, std::back_inserter(result), 0.0);
+            REQUIRE(result.size() == 8);
+            CHECK(useful::multidim::squared_distance(result.back(), target) ==
+                  Approx(expected[7]));
+
+            std::vector<point_type> within;
+            kdt.radius_query(target, 400.0f, std::back_inserter(within));
+            CHECK(within.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [](float d) {
+                          return d <= 400.0f;
+                      })));
+        }
+    };
+
+    SECTION("bulk built")
+    {
+        check_queries();
+    }
+
+    SECTION("buckets broken up by inserts and erases")
+    {
+        const auto find = [&kdt](const point_type& pt) {
+            return std::find_if(
+                kdt.cbegin(), kdt.cend(), [&pt](const auto& p) {
+                    return p.x == pt.x && p.y == pt.y;
+                });
+        };
+
+        const auto added = random_points(500, 79);
+        for(std::size_t i = 0; i < added.size(); ++i)
+        {
+            kdt.insert(added[i]);
+            kdt.erase(find(points[i]));
+        }
+
+        points.erase(points.begin(), points.begin() + added.size());
+        points.insert(points.end(), added.begin(), added.end());
+
+        CHECK(kdt.size() == points.size());
+        check_queries();
+
+        SECTION("rebuild")
+        {
+            kdt.rebuild();
+            check_queries();
+        }
+    }
+}
+
+
+namespace
+{
+std::vector<std::pair<float, float>>
+sorted_coordinates(const std::vector<point_type>& points)
+{
+    std::vector<std::pair<float, float>> out;
+    for(const auto& pt : points)
+    {
+        out.emplace_back(pt.x, pt.y);
+    }
+    std::sort(out.begin(), out.end());
+
+    return out;
+}
+} // namespace
+
+
+TEMPLATE_TEST_CASE("erase and insert against brute force",
+                   "[multidim::kdtree]",
+                   (kdtree<point_type, 1>),
+                   (kdtree<point_type, 4>),
+                   (kdtree<point_type, 16>))
+{
+    std::mt19937 gen(83);
+
+    const auto check_queries = [&gen](const TestType& kdt,
+                                      const std::vector<point_type>& live) {
+        REQUIRE(kdt.size() == live.size());
+
+        std::vector<point_type> result;
+        kdt.range_query(point_type{-100.0f, -100.0f},
+                        point_type{100.0f, 100.0f},
+                        std::back_inserter(result));
+        CHECK(sorted_coordinates(result) == sorted_coordinates(live));
+
+        for(const auto& target : random_points(5, gen()))
+        {
+            const auto expected = brute_force_distances(live, target);
+
+            result.clear();
+            kdt.k_nearest(target, 5, std::back_inserter(result));
+            REQUIRE(result.size() == std::min<std::size_t>(5, live.size()));
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+
+            result.clear();
+            kdt.radius_query(target, 900.0f, std::back_inserter(result));
+            CHECK(result.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [](float d) {
+                          return d <= 900.0f;
+                      })));
+        }
+    };
+
+    const auto erase_random = [&gen](TestType& kdt,
+                                     std::vector<point_type>& live) {
+        const std::size_t i =
+            std::uniform_int_distribution<std::size_t>(0, live.size() - 1)(
+                gen);
+        const point_type pt = live[i];
+
+        auto it = kdt.cbegin();
+        while(it->x != pt.x || it->y != pt.y || kdt.erased(it))
+        {
+            ++it;
+        }
+
+        kdt.erase(it);
+        live.erase(live.begin() + i);
+    };
+
+    SECTION("erase interior points of a single bucket")
+    {
+        for(unsigned seed = 0; seed < 20; ++seed)
+        {
+            auto live = random_points(16, 89 + seed);
+            TestType kdt(live.begin(), live.end());
+
+            while(!live.empty())
+            {
+                erase_random(kdt, live);
+                check_queries(kdt, live);
+            }
+        }
+    }
+
+    SECTION("mixed inserts and erases")
+    {
+        for(double ratio : {0.05, 0.25, 0.9})
+        {
+            auto live = random_points(300, 97);
+            TestType kdt(live.begin(), live.end());
+            kdt.max_erased_ratio(ratio);
+
+            const auto added = random_points(600, 101);
+            for(std::size_t i = 0; i < added.size(); ++i)
+            {
+                if(i % 3 == 0)
+                {
+                    kdt.insert(added[i]);
+                    live.push_back(added[i]);
+                }
+                else
+                {
+                    erase_random(kdt, live);
+                }
+
+                if(i % 25 == 0)
+                {
+                    check_queries(kdt, live);
+                }
+            }
+
+            check_queries(kdt, live);
+        }
+    }
+}
+
+
+TEST_CASE("split on the dimension of largest spread", "[multidim::kdtree]")
+{
+    // x spans a thousand times the range of y
+    std::mt19937 gen(83);
+    std::uniform_real_distribution<float> wide(0.0f, 10000.0f);
+    std::uniform_real_distribution<float> narrow(0.0f, 10.0f);
+
+    std::vector<point_type> points(4000);
+    for(auto& pt : points)
+    {
+        pt = point_type{wide(gen), narrow(gen)};
+    }
+
+    kdtree<point_type> kdt(points.begin(), points.end());
+
+    std::vector<point_type> added(500);
+    for(auto& pt : added)
+    {
+        pt = point_type{wide(gen), narrow(gen)};
+        kdt.insert(pt);
+    }
+    points.insert(points.end(), added.begin(), added.end());
+
+    for(int i = 0; i < 25; ++i)
+    {
+        const point_type target{wide(gen), narrow(gen)};
+        const auto expected = brute_force_distances(points, target);
+
+        std::vector<point_type> result;
+        kdt.k_nearest(target, 6, std::back_inserter(result));
+
+        REQUIRE(result.size() == 6);
+        for(std::size_t j = 0; j < result.size(); ++j)
+        {
+            CHECK(useful::multidim::squared_distance(result[j], target) ==
+                  Approx(expected[j]));
+        }
+    }
+
+    SECTION("a visit budget reaches the nearest point")
+    {
+        // round robin splits would spend every other level on y
+        std::size_t exact = 0;
+        for(int i = 0; i < 100; ++i)
+        {
+            const point_type target{wide(gen), narrow(gen)};
+
+            std::vector<point_type> approx;
+            kdt.approximate_k_nearest(
+                target, 1, std::back_inserter(approx), 0.0, 16);
+            exact += useful::multidim::squared_distance(approx[0], target) ==
+                     useful::multidim::squared_distance(*kdt.nearest(target),
+                                                        target);
+        }
+
+        CHECK(exact >= 90);
+    }
+}
+
+
+TEST_CASE("kdtree of std::array points", "[multidim::kdtree]")
+{
+    typedef std::array<float, 4> array4;
+
+    std::mt19937 gen(101);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<array4> points(1000);
+    for(auto& pt : points)
+    {
+        pt = array4{dist(gen), dist(gen), dist(gen), dist(gen)};
+    }
+
+    kdtree<array4> kdt(points.begin(), points.end());
+    kdt.insert(array4{5.0f, 5.0f, 5.0f, 5.0f});
+
+    const auto it = kdt.nearest(array4{4.0f, 4.0f, 4.0f, 4.0f});
+    REQUIRE(it != kdt.cend());
+    CHECK((*it)[0] == Approx(5.0f));
+}
+
+
+TEST_CASE("positions fit the packed records", "[multidim::kdtree]")
+{
+    // 9 bits of a record hold the bucket size and the erased flag, 1 bit
+    // the split dimension of a 2d point
+    CHECK(kdtree<point_type>::max_size() ==
+          std::size_t(1) << (std::numeric_limits<std::size_t>::digits - 10));
+    CHECK(kdtree<std::array<float, 4>>::max_size() ==
+          std::size_t(1) << (std::numeric_limits<std::size_t>::digits - 11));
+}
+
+
+TEST_CASE("kdtree of unsigned points", "[multidim::kdtree]")
+{
+    typedef std::array<unsigned, 2> point;
+
+    std::mt19937 gen(17);
+    std::uniform_int_distribution<unsigned> dist(0u, 1000u);
+
+    std::vector<point> points(500);
+    for(auto& pt : points)
+    {
+        pt = point{dist(gen), dist(gen)};
+    }
+
+    kdtree<point> kdt(points.begin(), points.end());
+
+    for(int q = 0; q < 200; ++q)
+    {
+        const point target{dist(gen), dist(gen)};
+
+        unsigned expected = useful::multidim::squared_distance(points[0],
+                                                               target);
+        for(const auto& pt : points)
+        {
+            expected = std::min(
+                expected, useful::multidim::squared_distance(pt, target));
+        }
+
+        const auto it = kdt.nearest(target);
+        REQUIRE(it != kdt.cend());
+        CHECK(useful::multidim::squared_distance(*it, target) == expected);
+    }
+}
@@ -0,0 +1,264 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+#include <catch2/catch.hpp>
+#include <kdtree_forest.hpp>
+
+
+namespace
+{
+struct feature
+{
+    float values[32];
+};
+} // namespace
+
+namespace useful
+{
+namespace multidim
+{
+template <>
+struct point_traits_<feature, void, void, void>
+{
+    static constexpr std::size_t dimensions = 32;
+
+    template <std::size_t U>
+    using value_type = float;
+
+    template <std::size_t U>
+    static float&
+    get(feature& pt)
+    {
+        return pt.values[U];
+    }
+
+    template <std::size_t U>
+    static const float&
+    get(const feature& pt)
+    {
+        return pt.values[U];
+    }
+};
+} // namespace multidim
+} // namespace useful
+
+
+namespace
+{
+std::vector<feature>
+random_features(std::size_t n, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<feature> out(n);
+    for(auto& pt : out)
+    {
+        for(float& value : pt.values)
+        {
+            value = dist(gen);
+        }
+    }
+
+    return out;
+}
+
+std::vector<float>
+brute_force_distances(const std::vector<feature>& points,
+                      const feature& target,
+                      std::size_t k)
+{
+    std::vector<float> distances;
+    for(const auto& pt : points)
+    {
+        distances.push_back(useful::multidim::squared_distance(pt, target));
+    }
+
+    std::sort(distances.begin(), distances.end());
+    distances.resize(std::min(k, distances.size()));
+    return distances;
+}
+
+// number of the exact k nearest found in approx
+std::size_t
+hits(const std::vector<float>& exact,
+     const std::vector<feature>& approx,
+     const feature& target)
+{
+    std::size_t found = 0;
+    for(const auto& pt : approx)
+    {
+        if(useful::multidim::squared_distance(pt, target) <= exact.back())
+        {
+            ++found;
+        }
+    }
+
+    return found;
+}
+} // namespace
+
+using useful::multidim::kdtree_forest;
+
+
+TEST_CASE("construct a kdtree_forest", "[multidim::kdtree_forest]")
+{
+    SECTION("empty")
+    {
+        kdtree_forest<feature> forest;
+
+        CHECK(forest.empty());
+
+        std::vector<feature> out;
+        forest.approximate_k_nearest(
+            feature{}, 3, std::back_inserter(out), 0.0);
+        CHECK(out.empty());
+    }
+
+    SECTION("points are shared by the trees")
+    {
+        const auto points = random_features(500, 3);
+        kdtree_forest<feature> forest(points.begin(), points.end(), 8);
+
+        CHECK(forest.size() == points.size());
+        CHECK(forest.trees() == 8);
+        CHECK(std::distance(forest.cbegin(), forest.cend()) == 500);
+    }
+}
+
+
+TEST_CASE("query a kdtree_forest", "[multidim::kdtree_forest]")
+{
+    const auto points = random_features(4000, 5);
+    const auto targets = random_features(25, 7);
+    const std::size_t k = 10;
+
+    kdtree_forest<feature> forest(points.begin(), points.end(), 4);
+
+    SECTION("exact k nearest")
+    {
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target, k);
+
+            std::vector<feature> found;
+            forest.k_nearest(target, k, std::back_inserter(found));
+
+            REQUIRE(found.size() == expected.size());
+            for(std::size_t i = 0; i < found.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(found[i], target) ==
+                      Approx(expected[i]));
+            }
+        }
+    }
+
+    SECTION("unlimited approximate search is exact")
+    {
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target, k);
+
+            std::vector<feature> found;
+            forest.approximate_k_nearest(
+                target, k, std::back_inserter(found), 0.0);
+
+            REQUIRE(found.size() == expected.size());
+            for(std::size_t i = 0; i < found.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(found[i], target) ==
+                      Approx(expected[i]));
+            }
+        }
+    }
+
+    SECTION("points reached through several trees are kept once")
+    {
+        for(const auto& target : targets)
+        {
+            std::vector<feature> found;
+            forest.approximate_k_nearest(
+                target, k, std::back_inserter(found), 0.0, 400);
+
+            REQUIRE(found.size() == k);
+            for(std::size_t i = 1; i < found.size(); ++i)
+            {
+                // a duplicate would repeat the previous distance
+                CHECK(useful::multidim::squared_distance(found[i - 1],
+                                                         target) <
+                      useful::multidim::squared_distance(found[i], target));
+            }
+        }
+    }
+
+    SECTION("several trees find more neighbours for the same budget")
+    {
+        kdtree_forest<feature> single(points.begin(), points.end(), 1);
+
+        std::size_t forest_hits = 0, single_hits = 0;
+        for(const auto& target : targets)
+        {
+            const auto expected = brute_force_distances(points, target, k);
+
+            std::vector<feature> found;
+            forest.approximate_k_nearest(
+                target, k, std::back_inserter(found), 0.0, 400);
+            forest_hits += hits(expected, found, target);
+
+            found.clear();
+            single.approximate_k_nearest(
+                target, k, std::back_inserter(found), 0.0, 400);
+            single_hits += hits(expected, found, target);
+        }
+
+        CHECK(forest_hits > single_hits);
+    }
+}
+
+
+TEST_CASE("query a kdtree_forest of integer points",
+          "[multidim::kdtree_forest]")
+{
+    typedef std::array<int, 2> point;
+
+    std::mt19937 gen(97);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+
+    std::vector<point> points(5000);
+    for(auto& pt : points)
+    {
+        pt = point{dist(gen), dist(gen)};
+    }
+
+    kdtree_forest<point> forest(points.begin(), points.end(), 1);
+
+    const double eps = 0.5;
+    std::size_t inexact = 0;
+    for(int q = 0; q < 200; ++q)
+    {
+        const point target{dist(gen), dist(gen)};
+
+        int exact = useful::multidim::squared_distance(points[0], target);
+        for(const auto& pt : points)
+        {
+            exact = std::min(exact,
+                             useful::multidim::squared_distance(pt, target));
+        }
+
+        std::vector<point> found;
+        forest.approximate_k_nearest(
+            target, 1, std::back_inserter(found), eps);
+
+        REQUIRE(found.size() == 1);
+        const int distance =
+            useful::multidim::squared_distance(found[0], target);
+        CHECK(distance <= (1.0 + eps) * exact);
+        inexact += distance != exact ? 1ul : 0ul;
+    }
+
+    // a scale truncated to 1 would make every query exact
+    CHECK(inexact > 0);
+}
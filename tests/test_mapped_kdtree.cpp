@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <iterator>
+#include <stdexcept>
+
+#include <catch2/catch.hpp>
+#include <mapped_kdtree.hpp>
+
+
+namespace
+{
+struct grid_point
+{
+    double x, y;
+};
+
+bool
+same(const grid_point& lhs, const grid_point& rhs)
+{
+    return lhs.x == rhs.x && lhs.y == rhs.y;
+}
+} // namespace
+
+using useful::multidim::kdtree;
+using useful::multidim::mapped_kdtree;
+
+
+TEST_CASE("save and map a kdtree snapshot", "[multidim::mapped_kdtree]")
+{
+    const std::string path = "test_mapped_kdtree.snapshot";
+
+    std::mt19937 gen(59);
+    std::uniform_real_distribution<double> dist(0.0, 1000.0);
+
+    std::vector<grid_point> points(3000);
+    for(auto& pt : points)
+    {
+        pt = grid_point{dist(gen), dist(gen)};
+    }
+
+    kdtree<grid_point> original(points.begin(), points.end());
+    original.insert(grid_point{500.0, 500.0});
+    original.erase(original.cbegin());
+    original.save(path);
+
+    SECTION("mapped tree answers like the original")
+    {
+        mapped_kdtree<grid_point> mapped(path);
+
+        CHECK(mapped.size() == original.size());
+
+        for(int i = 0; i < 20; ++i)
+        {
+            const grid_point target{dist(gen), dist(gen)};
+
+            std::vector<grid_point> expected, result;
+            original.k_nearest(target, 5, std::back_inserter(expected));
+            mapped.k_nearest(target, 5, std::back_inserter(result));
+
+            REQUIRE(result.size() == expected.size());
+            CHECK(std::equal(
+                result.begin(), result.end(), expected.begin(), same));
+
+            expected.clear();
+            result.clear();
+            original.radius_query(target, 900.0, std::back_inserter(expected));
+            mapped.radius_query(target, 900.0, std::back_inserter(result));
+
+            CHECK(result.size() == expected.size());
+        }
+
+        SECTION("move the mapping")
+        {
+            mapped_kdtree<grid_point> moved(std::move(mapped));
+
+            CHECK(mapped.empty());
+            CHECK(moved.size() == original.size());
+            CHECK(same(*moved.nearest(grid_point{500.0, 500.0}),
+                       grid_point{500.0, 500.0}));
+        }
+    }
+
+    SECTION("load into a mutable tree")
+    {
+        kdtree<grid_point> loaded;
+        loaded.load(path);
+
+        CHECK(loaded.size() == original.size());
+        CHECK(std::equal(
+            loaded.cbegin(), loaded.cend(), original.cbegin(), same));
+
+        loaded.insert(grid_point{-1.0, -1.0});
+        CHECK(same(*loaded.nearest(grid_point{-2.0, -2.0}),
+                   grid_point{-1.0, -1.0}));
+    }
+
+    SECTION("reject other point types")
+    {
+        struct other_point
+        {
+            float x, y;
+        };
+
+        CHECK_THROWS_AS(mapped_kdtree<other_point>(path), std::runtime_error);
+    }
+
+    SECTION("reject files that are not snapshots")
+    {
+        {
+            std::ofstream out(path, std::ios::trunc);
+            out << "definitely not a snapshot, but long enough to hold a "
+                   "snapshot header so the magic is checked";
+        }
+
+        CHECK_THROWS_AS(mapped_kdtree<grid_point>(path), std::runtime_error);
+        CHECK_THROWS_AS(original.load(path), std::runtime_error);
+    }
+
+    SECTION("reject corrupt snapshots")
+    {
+        typedef useful::multidim::kdtree_detail::snapshot_header header_type;
+
+        // overwrites 8 bytes at offset of the saved snapshot
+        const auto patch = [&path](std::streamoff offset,
+                                   std::uint64_t value) {
+            std::fstream file(
+                path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(offset);
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+
+        const std::streamoff records =
+            useful::multidim::kdtree_detail::snapshot_records_offset(
+                original.cend() - original.cbegin(), sizeof(grid_point));
+
+        SECTION("size overflowing the file size check")
+        {
+            patch(offsetof(header_type, size), std::uint64_t(1) << 61);
+        }
+
+        SECTION("more erased points than points")
+        {
+            patch(offsetof(header_type, erased), 1u << 20);
+        }
+
+        SECTION("child out of range")
+        {
+            // the smaller child of the root
+            patch(records, 1u << 30);
+        }
+
+        SECTION("child not linked back to its parent")
+        {
+            patch(records, 2u);
+        }
+
+        CHECK_THROWS_AS(mapped_kdtree<grid_point>(path), std::runtime_error);
+        CHECK_THROWS_AS(original.load(path), std::runtime_error);
+    }
+
+    std::remove(path.c_str());
+}
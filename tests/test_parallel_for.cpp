@@ -0,0 +1,128 @@
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include <catch2/catch.hpp>
+#include <parallel_for.hpp>
+#include <handle_map.hpp>
+
+
+TEST_CASE("run chunks in parallel", "[parallel_for]")
+{
+    SECTION("chunks cover the range once at fixed boundaries")
+    {
+        for(unsigned threads : {1u, 3u, 16u})
+        {
+            std::vector<int> visits(1000);
+            std::vector<std::pair<std::size_t, std::size_t>> chunks;
+            std::mutex mutex;
+
+            useful::parallel_for(
+                visits.size(),
+                64,
+                [&](std::size_t first, std::size_t last) {
+                    for(std::size_t i = first; i < last; ++i)
+                    {
+                        ++visits[i];
+                    }
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chunks.emplace_back(first, last);
+                },
+                threads);
+
+            CHECK(std::count(visits.begin(), visits.end(), 1) == 1000);
+
+            std::sort(chunks.begin(), chunks.end());
+            REQUIRE(chunks.size() == 16);
+            for(std::size_t i = 0; i < chunks.size(); ++i)
+            {
+                CHECK(chunks[i].first == i * 64);
+                CHECK(chunks[i].second == std::min(1000ul, (i + 1) * 64));
+            }
+        }
+    }
+
+    SECTION("empty range")
+    {
+        bool called = false;
+        useful::parallel_for(
+            0, 64, [&](std::size_t, std::size_t) { called = true; });
+        CHECK_FALSE(called);
+    }
+
+    SECTION("chunk must be positive")
+    {
+        CHECK_THROWS_AS(
+            useful::parallel_for(10, 0, [](std::size_t, std::size_t) {}),
+            std::runtime_error);
+    }
+
+    SECTION("exceptions reach the caller")
+    {
+        CHECK_THROWS_AS(useful::parallel_for(
+                            1000,
+                            10,
+                            [](std::size_t first, std::size_t) {
+                                if(first == 500)
+                                {
+                                    throw std::logic_error("failed chunk");
+                                }
+                            },
+                            4),
+                        std::logic_error);
+    }
+}
+
+
+TEST_CASE("run chunks of a handle_map in parallel", "[parallel_for]")
+{
+    useful::handle_map<double> map;
+    std::vector<useful::handle_map<double>::handle_type> handles;
+
+    const std::size_t count = 2 * map.parallel_chunk + 5;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        handles.push_back(map.insert(double(i)));
+    }
+
+    // leaves the dense storage out of handle order
+    for(std::size_t i = 0; i < count; i += 7)
+    {
+        map.erase(handles[i]);
+    }
+
+    std::atomic<std::size_t> total(0);
+    map.parallel_for_each_chunk(
+        [&](std::size_t n, double* values) {
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                values[i] *= 2.0;
+            }
+            total += n;
+        },
+        4);
+
+    CHECK(total == map.size());
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        if(i % 7 != 0)
+        {
+            CHECK(map[handles[i]] == 2.0 * i);
+        }
+    }
+
+    const useful::handle_map<double>& const_map = map;
+    std::atomic<std::size_t> chunks(0);
+    const_map.parallel_for_each_chunk(
+        [&](std::size_t n, const double*) {
+            if(n > 0)
+            {
+                ++chunks;
+            }
+        });
+    CHECK(chunks == 2);
+}
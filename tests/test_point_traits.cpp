@@ -1,4 +1,7 @@
+#include <array>
+#include <tuple>
 #include <vector>
+#include <random>
 
 #include <catch2/catch.hpp>
 #include <point_traits.hpp>
@@ -14,6 +17,39 @@ struct point2d
     float x, y;
 };
 
+struct sample
+{
+    double time;
+    float value;
+    float weight;
+    int channel;
+};
+
+USEFUL_MULTIDIM_REGISTER_POINT(sample,
+                               &sample::time,
+                               &sample::value,
+                               &sample::weight,
+                               &sample::channel)
+
+class vector5
+{
+public:
+    float& operator[](std::size_t i)
+    {
+        return values_[i];
+    }
+
+    const float& operator[](std::size_t i) const
+    {
+        return values_[i];
+    }
+
+private:
+    float values_[5];
+};
+
+USEFUL_MULTIDIM_REGISTER_INDEXED_POINT(vector5, float, 5)
+
 TEST_CASE("test point_traits with xyz-like struct", "[point_traits]")
 {
     constexpr std::size_t dims =
@@ -87,3 +123,227 @@ TEST_CASE("test point algorithms with a range of points", "[point_traits]")
 
     CHECK(res.x == Approx(2.0f));
 }
+
+TEST_CASE("test distance kernels", "[point_traits]")
+{
+    const point2d a{1.0f, 5.0f};
+    const point2d b{4.0f, 1.0f};
+
+    CHECK(useful::multidim::squared_distance(a, b) == Approx(25.0f));
+    CHECK(useful::multidim::manhattan_distance(a, b) == Approx(7.0f));
+    CHECK(useful::multidim::chebyshev_distance(a, b) == Approx(4.0f));
+    CHECK(useful::multidim::dot(a, b) == Approx(9.0f));
+
+    SECTION("mixed and unsigned dimensions")
+    {
+        const point p{1.0f, 2.0f, 3};
+        const point q{2.0f, 0.0f, 7};
+
+        CHECK(useful::multidim::manhattan_distance(p, q) == Approx(7.0f));
+        CHECK(useful::multidim::chebyshev_distance(p, q) == Approx(4.0f));
+
+        const unsigned u[2] = {3u, 10u};
+        const unsigned v[2] = {5u, 4u};
+
+        CHECK(useful::multidim::manhattan_distance(u, v) == 8u);
+        CHECK(useful::multidim::chebyshev_distance(u, v) == 6u);
+    }
+}
+
+TEST_CASE("test batched distance kernels", "[point_traits]")
+{
+    float points[37][4];
+    for(int i = 0; i < 37; ++i)
+    {
+        for(int dim = 0; dim < 4; ++dim)
+        {
+            points[i][dim] = float((i * 7 + dim * 13) % 23) - 11.0f;
+        }
+    }
+
+    const float query[4] = {0.5f, -2.0f, 3.0f, 1.0f};
+    float out[37];
+
+    SECTION("squared euclidean")
+    {
+        useful::multidim::distances(query, points, points + 37, out);
+
+        for(int i = 0; i < 37; ++i)
+        {
+            CHECK(out[i] ==
+                  Approx(useful::multidim::squared_distance(query, points[i])));
+        }
+    }
+
+    SECTION("manhattan and chebyshev")
+    {
+        useful::multidim::distances(
+            query, points, points + 37, out, useful::multidim::manhattan());
+        for(int i = 0; i < 37; ++i)
+        {
+            CHECK(out[i] == Approx(useful::multidim::manhattan_distance(
+                                query, points[i])));
+        }
+
+        useful::multidim::distances(
+            query, points, points + 37, out, useful::multidim::chebyshev());
+        for(int i = 0; i < 37; ++i)
+        {
+            CHECK(out[i] == Approx(useful::multidim::chebyshev_distance(
+                                query, points[i])));
+        }
+    }
+
+    SECTION("dot products")
+    {
+        useful::multidim::dot_products(query, points, points + 37, out);
+
+        for(int i = 0; i < 37; ++i)
+        {
+            CHECK(out[i] == Approx(useful::multidim::dot(query, points[i])));
+        }
+    }
+
+    SECTION("structs take the generic path")
+    {
+        const std::vector<point2d> structs{{1.0f, 1.0f}, {-2.0f, 3.0f}};
+        float result[2];
+
+        useful::multidim::distances(point2d{0.0f, 0.0f},
+                                    structs.data(),
+                                    structs.data() + structs.size(),
+                                    result,
+                                    useful::multidim::manhattan());
+
+        CHECK(result[0] == Approx(2.0f));
+        CHECK(result[1] == Approx(5.0f));
+    }
+}
+
+TEST_CASE("test reductions over large ranges of points", "[point_traits]")
+{
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+    // far from the origin, where float sums lose the noise entirely
+    std::vector<point2d> points(100000);
+    for(auto& pt : points)
+    {
+        pt = point2d{10000.0f + noise(gen), -20.0f + noise(gen)};
+    }
+
+    double sum_x = 0.0, sum_y = 0.0;
+    for(const auto& pt : points)
+    {
+        sum_x += pt.x;
+        sum_y += pt.y;
+    }
+    const double mean_x = sum_x / points.size();
+    const double mean_y = sum_y / points.size();
+
+    double var_x = 0.0, var_y = 0.0;
+    for(const auto& pt : points)
+    {
+        var_x += (pt.x - mean_x) * (pt.x - mean_x);
+        var_y += (pt.y - mean_y) * (pt.y - mean_y);
+    }
+    var_x /= points.size();
+    var_y /= points.size();
+
+    for(unsigned threads : {1u, 4u})
+    {
+        const auto mean = useful::multidim::arithmetic_mean(
+            points.begin(), points.end(), threads);
+        CHECK(mean.x == Approx(mean_x).epsilon(1e-7));
+        CHECK(mean.y == Approx(mean_y).epsilon(1e-6));
+
+        const auto var = useful::multidim::variance(
+            points.begin(), points.end(), threads);
+        CHECK(var.x == Approx(var_x).epsilon(1e-5));
+        CHECK(var.y == Approx(var_y).epsilon(1e-5));
+
+        const auto box = useful::multidim::bounding_box(
+            points.begin(), points.end(), threads);
+        const auto x = std::minmax_element(
+            points.begin(),
+            points.end(),
+            [](const point2d& a, const point2d& b) { return a.x < b.x; });
+        const auto y = std::minmax_element(
+            points.begin(),
+            points.end(),
+            [](const point2d& a, const point2d& b) { return a.y < b.y; });
+
+        CHECK(box.first.x == x.first->x);
+        CHECK(box.second.x == x.second->x);
+        CHECK(box.first.y == y.first->y);
+        CHECK(box.second.y == y.second->y);
+    }
+}
+
+TEST_CASE("test point_traits adapters", "[point_traits]")
+{
+    SECTION("std::array")
+    {
+        typedef std::array<float, 4> array4;
+        static_assert(useful::multidim::point_traits<array4>::dimensions == 4,
+                      "dimensions are usable in constant expressions");
+
+        array4 a{1.0f, 2.0f, 3.0f, 4.0f};
+        useful::multidim::point_traits<array4>::get<3>(a) = 8.0f;
+
+        CHECK(a[3] == Approx(8.0f));
+        CHECK(useful::multidim::squared_distance(a, array4{}) ==
+              Approx(78.0f));
+
+        const std::vector<array4> points{{1.0f, 0.0f, 0.0f, 0.0f},
+                                         {3.0f, 2.0f, 0.0f, 4.0f}};
+        const auto mean =
+            useful::multidim::arithmetic_mean(points.begin(), points.end());
+        CHECK(mean[0] == Approx(2.0f));
+        CHECK(mean[3] == Approx(2.0f));
+
+        float out[2];
+        useful::multidim::distances(
+            array4{}, points.data(), points.data() + 2, out);
+        CHECK(out[1] == Approx(29.0f));
+    }
+
+    SECTION("std::tuple")
+    {
+        typedef std::tuple<int, double> pair_point;
+        static_assert(std::is_same<useful::multidim::coordinate_type<
+                                       pair_point>,
+                                   double>::value,
+                      "common type of the dimensions");
+
+        const pair_point p{2, 0.5};
+        CHECK(useful::multidim::point_traits<pair_point>::get<0>(p) == 2);
+        CHECK(useful::multidim::manhattan_distance(p, pair_point{0, 1.5}) ==
+              Approx(3.0));
+    }
+
+    SECTION("registered members")
+    {
+        static_assert(useful::multidim::point_traits<sample>::dimensions == 4,
+                      "one dimension per member");
+
+        sample s{1.0, 2.0f, 3.0f, 4};
+        useful::multidim::apply(s, [](auto& value) { value += 1; });
+
+        CHECK(s.time == Approx(2.0));
+        CHECK(s.channel == 5);
+        CHECK(useful::multidim::coordinate(s, 2) == Approx(4.0));
+    }
+
+    SECTION("registered indexed type")
+    {
+        vector5 v;
+        for(std::size_t i = 0; i < 5; ++i)
+        {
+            v[i] = float(i);
+        }
+
+        CHECK(useful::multidim::point_traits<vector5>::dimensions == 5);
+        CHECK(useful::multidim::dot(v, v) == Approx(30.0f));
+    }
+}
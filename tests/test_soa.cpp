@@ -0,0 +1,606 @@
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
+
+#include <catch2/catch.hpp>
+#include <soa.hpp>
+#include <arena_soa.hpp>
+#include <aosoa.hpp>
+
+
+namespace
+{
+struct particle
+{
+    float x;
+    float v;
+    int id;
+};
+
+typedef useful::soa<
+    particle,
+    useful::member_container<decltype(&particle::x), &particle::x>,
+    useful::member_container<decltype(&particle::v), &particle::v>,
+    useful::member_container<decltype(&particle::id), &particle::id>>
+    particle_table;
+
+struct record
+{
+    double weight;
+    std::string name;
+    char tag;
+};
+
+typedef useful::arena_soa<
+    record,
+    useful::member_container<decltype(&record::weight), &record::weight>,
+    useful::member_container<decltype(&record::name), &record::name>,
+    useful::member_container<decltype(&record::tag), &record::tag>>
+    record_table;
+
+typedef useful::arena_soa<
+    particle,
+    useful::member_container<decltype(&particle::x), &particle::x>,
+    useful::member_container<decltype(&particle::v), &particle::v>,
+    useful::member_container<decltype(&particle::id), &particle::id>>
+    particle_arena;
+
+typedef useful::aosoa<
+    particle,
+    8,
+    useful::member_container<decltype(&particle::x), &particle::x>,
+    useful::member_container<decltype(&particle::v), &particle::v>,
+    useful::member_container<decltype(&particle::id), &particle::id>>
+    particle_blocks;
+
+typedef useful::aosoa<
+    record,
+    4,
+    useful::member_container<decltype(&record::weight), &record::weight>,
+    useful::member_container<decltype(&record::name), &record::name>,
+    useful::member_container<decltype(&record::tag), &record::tag>>
+    record_blocks;
+
+template <class Pointer>
+bool
+aligned(Pointer ptr)
+{
+    return reinterpret_cast<std::uintptr_t>(ptr) % record_table::alignment ==
+           0;
+}
+
+particle_table
+random_particles(std::size_t n, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    particle_table out;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        const float x = dist(gen);
+        // v and id follow x to check that columns move together
+        out.push_back(particle{x, 2.0f * x, static_cast<int>(i)});
+    }
+
+    return out;
+}
+
+void
+check_lockstep(const particle_table& table, std::size_t n)
+{
+    REQUIRE(table.size() == n);
+
+    std::vector<int> ids;
+    for(particle p : table)
+    {
+        CHECK(p.v == 2.0f * p.x);
+        ids.push_back(p.id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        CHECK(ids[i] == static_cast<int>(i));
+    }
+}
+
+bool
+by_x(const particle& lhs, const particle& rhs)
+{
+    return lhs.x < rhs.x;
+}
+} // namespace
+
+
+TEST_CASE("iterate a soa", "[soa]")
+{
+    auto table = random_particles(100, 3);
+    const particle_table& const_table = table;
+
+    SECTION("iterators visit every element in order")
+    {
+        CHECK(std::distance(table.begin(), table.end()) == 100);
+        CHECK(const_table.end() - const_table.begin() == 100);
+
+        int expected = 0;
+        for(auto it = table.cbegin(); it != table.cend(); ++it)
+        {
+            const particle p = *it;
+            CHECK(p.id == expected++);
+        }
+
+        auto it = table.begin() + 10;
+        CHECK(it[5].get<2>() == 15);
+        CHECK((*(it - 3)).get<2>() == 7);
+        CHECK((--it).index() == 9);
+
+        particle_table::const_iterator converted = it;
+        CHECK(converted == table.cbegin() + 9);
+        CHECK(converted < table.cend());
+
+        static_assert(
+            std::is_convertible<particle_table::iterator,
+                                particle_table::const_iterator>::value,
+            "iterator converts to const_iterator");
+        static_assert(
+            !std::is_constructible<particle_table::iterator,
+                                   particle_table::const_iterator>::value,
+            "const_iterator does not convert to iterator");
+        static_assert(
+            !std::is_constructible<particle_table::const_iterator,
+                                   particle_arena::iterator>::value,
+            "iterators of other containers do not convert");
+    }
+
+    SECTION("writing through iterators writes every column")
+    {
+        *table.begin() = particle{5.0f, 6.0f, 7};
+        table.begin()[1].get<1>() = 8.0f;
+
+        const particle first = const_table[0];
+        CHECK(first.x == 5.0f);
+        CHECK(first.v == 6.0f);
+        CHECK(first.id == 7);
+        CHECK(const_table[1].get<1>() == 8.0f);
+    }
+}
+
+
+TEST_CASE("run standard algorithms on a soa", "[soa]")
+{
+    auto table = random_particles(1000, 5);
+
+    SECTION("sort")
+    {
+        std::sort(table.begin(), table.end(), by_x);
+
+        CHECK(std::is_sorted(table.cbegin(), table.cend(), by_x));
+        check_lockstep(table, 1000);
+    }
+
+    SECTION("stable sort")
+    {
+        auto coarse = [](const particle& lhs, const particle& rhs) {
+            return lhs.x < 0.0f && !(rhs.x < 0.0f);
+        };
+
+        std::stable_sort(table.begin(), table.end(), coarse);
+
+        CHECK(std::is_sorted(table.cbegin(), table.cend(), coarse));
+        check_lockstep(table, 1000);
+
+        // ids were ascending, and stay so within each half
+        const auto middle = std::partition_point(
+            table.cbegin(), table.cend(), [](const particle& p) {
+                return p.x < 0.0f;
+            });
+        CHECK(std::is_sorted(
+            table.cbegin(),
+            middle,
+            [](const particle& lhs, const particle& rhs) {
+                return lhs.id < rhs.id;
+            }));
+    }
+
+    SECTION("partition, reverse and rotate")
+    {
+        const auto middle =
+            std::partition(table.begin(), table.end(), [](const particle& p) {
+                return p.x < 0.0f;
+            });
+        CHECK(std::all_of(table.begin(), middle, [](const particle& p) {
+            return p.x < 0.0f;
+        }));
+        CHECK(std::none_of(middle, table.end(), [](const particle& p) {
+            return p.x < 0.0f;
+        }));
+
+        std::reverse(table.begin(), table.end());
+        std::rotate(table.begin(), table.begin() + 300, table.end());
+
+        check_lockstep(table, 1000);
+    }
+
+    SECTION("swap elements")
+    {
+        const particle first = table[0];
+        const particle second = table[1];
+
+        swap(table[0], table[1]);
+
+        CHECK(table[0].get<2>() == second.id);
+        CHECK(table[1].get<2>() == first.id);
+        CHECK(table[1].get<0>() == first.x);
+    }
+}
+
+
+TEST_CASE("access soa columns", "[soa]")
+{
+    auto table = random_particles(100, 7);
+
+    auto ids = table.column<decltype(&particle::id), &particle::id>();
+    REQUIRE(ids.size() == 100);
+    CHECK(std::accumulate(ids.begin(), ids.end(), 0) == 99 * 100 / 2);
+
+    for(float& x : table.column<decltype(&particle::x), &particle::x>())
+    {
+        x = 1.0f;
+    }
+
+    const particle_table& const_table = table;
+    const auto xs = const_table.column<decltype(&particle::x), &particle::x>();
+    CHECK(std::count(xs.cbegin(), xs.cend(), 1.0f) == 100);
+    CHECK(xs.data() == table.data<decltype(&particle::x), &particle::x>());
+}
+
+
+TEST_CASE("store a soa in a single arena", "[soa]")
+{
+    record_table table;
+    CHECK(table.empty());
+    CHECK(table.capacity() == 0);
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        table.push_back(
+            record{i * 0.5, "record " + std::to_string(i), char('a' + i % 26)});
+    }
+
+    REQUIRE(table.size() == 1000);
+    CHECK(table.capacity() >= 1000);
+
+    SECTION("columns are aligned and values survive growth")
+    {
+        CHECK(aligned(
+            table.data<decltype(&record::weight), &record::weight>()));
+        CHECK(aligned(table.data<decltype(&record::name), &record::name>()));
+        CHECK(aligned(table.data<decltype(&record::tag), &record::tag>()));
+
+        for(int i = 0; i < 1000; ++i)
+        {
+            const record r = table[i];
+            CHECK(r.weight == i * 0.5);
+            CHECK(r.name == "record " + std::to_string(i));
+            CHECK(r.tag == char('a' + i % 26));
+        }
+    }
+
+    SECTION("reserve moves all columns at once")
+    {
+        table.reserve(5000);
+        CHECK(table.capacity() == 5000);
+        CHECK(aligned(table.data<decltype(&record::tag), &record::tag>()));
+
+        const auto names =
+            table.column<decltype(&record::name), &record::name>();
+        CHECK(names[999] == "record 999");
+
+        // no reallocation below the capacity
+        const auto* first = names.data();
+        table.push_back_members(1.0, std::string("pushed"), 'z');
+        CHECK(table.data<decltype(&record::name), &record::name>() == first);
+        CHECK(table[1000].get<1>() == "pushed");
+    }
+
+    SECTION("push members referring to elements across growth")
+    {
+        while(table.size() < table.capacity())
+        {
+            table.push_back_members(0.0, std::string("filler"), 'f');
+        }
+
+        const std::size_t size = table.size();
+        table.push_back_members(
+            table[3].get<0>(), table[3].get<1>(), table[3].get<2>());
+
+        REQUIRE(table.size() == size + 1);
+        CHECK(table.capacity() > size);
+        const record r = table[size];
+        CHECK(r.weight == 1.5);
+        CHECK(r.name == "record 3");
+        CHECK(r.tag == 'd');
+        CHECK(table[3].get<1>() == "record 3");
+    }
+
+    SECTION("copy and move")
+    {
+        record_table copy = table;
+        REQUIRE(copy.size() == table.size());
+        CHECK(copy[10].get<1>() == "record 10");
+
+        copy[10].get<1>() = "changed";
+        CHECK(table[10].get<1>() == "record 10");
+
+        record_table moved = std::move(copy);
+        CHECK(moved.size() == 1000);
+        CHECK(moved[10].get<1>() == "changed");
+        CHECK(copy.empty());
+
+        copy = moved;
+        CHECK(copy[10].get<1>() == "changed");
+
+        moved.clear();
+        CHECK(moved.empty());
+        CHECK(copy.size() == 1000);
+    }
+
+    SECTION("iterators permute every column")
+    {
+        std::sort(table.begin(),
+                  table.end(),
+                  [](const record& lhs, const record& rhs) {
+                      return lhs.weight > rhs.weight;
+                  });
+
+        for(std::size_t i = 0; i < table.size(); ++i)
+        {
+            const record r = table[i];
+            const int source = static_cast<int>(999 - i);
+            CHECK(r.weight == source * 0.5);
+            CHECK(r.name == "record " + std::to_string(source));
+        }
+    }
+}
+
+
+TEST_CASE("store a soa in blocks", "[soa]")
+{
+    particle_blocks blocks;
+    CHECK(blocks.empty());
+
+    for(int i = 0; i < 100; ++i)
+    {
+        blocks.push_back(particle{i * 1.0f, i * 2.0f, i});
+    }
+
+    REQUIRE(blocks.size() == 100);
+    CHECK(blocks.block_count() == 13);
+
+    SECTION("elements read back through proxies")
+    {
+        for(int i = 0; i < 100; ++i)
+        {
+            const particle p = blocks[i];
+            CHECK(p.x == i * 1.0f);
+            CHECK(p.v == i * 2.0f);
+            CHECK(p.id == i);
+        }
+
+        blocks[42] = particle{-1.0f, -2.0f, -3};
+        CHECK(blocks[42].get<2>() == -3);
+    }
+
+    SECTION("members are contiguous within a block")
+    {
+        const particle_blocks& const_blocks = blocks;
+        const float* vs =
+            const_blocks.block_data<decltype(&particle::v), &particle::v>(3);
+        for(std::size_t lane = 0; lane < particle_blocks::width; ++lane)
+        {
+            CHECK(vs[lane] == (24.0f + lane) * 2.0f);
+        }
+
+        CHECK(aligned(
+            blocks.block_data<decltype(&particle::x), &particle::x>(5)));
+    }
+
+    SECTION("iterators permute every member")
+    {
+        std::sort(blocks.begin(),
+                  blocks.end(),
+                  [](const particle& lhs, const particle& rhs) {
+                      return lhs.id > rhs.id;
+                  });
+
+        for(int i = 0; i < 100; ++i)
+        {
+            const particle p = blocks[i];
+            CHECK(p.id == 99 - i);
+            CHECK(p.v == 2.0f * p.x);
+        }
+    }
+
+    SECTION("push members and clear")
+    {
+        blocks.push_back_members(0.5f, 1.0f, 100);
+        CHECK(blocks.size() == 101);
+        CHECK(blocks[100].get<0>() == 0.5f);
+
+        blocks.clear();
+        CHECK(blocks.empty());
+        CHECK(blocks.block_count() == 0);
+    }
+
+    SECTION("push members referring to elements across new blocks")
+    {
+        record_blocks records;
+        records.push_back_members(0.5, std::string("first"), 'a');
+
+        // every fourth push starts a block, growing the storage at times
+        for(int i = 1; i < 200; ++i)
+        {
+            const std::size_t source = static_cast<std::size_t>(i / 2);
+            records.push_back_members(records[source].get<0>(),
+                                      records[source].get<1>(),
+                                      records[source].get<2>());
+        }
+
+        REQUIRE(records.size() == 200);
+        for(std::size_t i = 0; i < 200; ++i)
+        {
+            const record r = records[i];
+            CHECK(r.weight == 0.5);
+            CHECK(r.name == "first");
+            CHECK(r.tag == 'a');
+        }
+    }
+}
+
+
+TEMPLATE_TEST_CASE("run column kernels",
+                   "[soa]",
+                   particle_table,
+                   particle_arena,
+                   particle_blocks)
+{
+    TestType table;
+    // not a multiple of any chunk
+    for(int i = 0; i < 1234; ++i)
+    {
+        table.push_back(particle{i * 1.0f, 0.5f, i});
+    }
+
+    SECTION("for_each_columns covers every element once")
+    {
+        std::size_t calls = 0;
+        std::size_t total = 0;
+        table.template for_each_columns<&particle::x, &particle::v>(
+            [&](std::size_t n, float* x, const float* v) {
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    x[i] += v[i];
+                }
+                ++calls;
+                total += n;
+            });
+
+        CHECK(total == 1234);
+        CHECK(calls > 1);
+        for(int i = 0; i < 1234; ++i)
+        {
+            CHECK(table[i].template get<0>() == i + 0.5f);
+        }
+    }
+
+    SECTION("full chunks pass their size as a constant")
+    {
+        std::size_t constant = 0;
+        std::size_t runtime = 0;
+        std::size_t runtime_calls = 0;
+        table.template for_each_columns<&particle::id>(
+            [&](auto n, const int*) {
+                if(std::is_same<decltype(n), std::size_t>::value)
+                {
+                    runtime += n;
+                    ++runtime_calls;
+                }
+                else
+                {
+                    constant += n;
+                }
+            });
+
+        CHECK(constant > 0);
+        CHECK(constant + runtime == 1234);
+        CHECK(runtime_calls == 1);
+    }
+
+    SECTION("transform")
+    {
+        table.template transform<&particle::v, &particle::x, &particle::id>(
+            [](float x, int id) { return x + 2.0f * id; });
+
+        for(int i = 0; i < 1234; ++i)
+        {
+            CHECK(table[i].template get<1>() == 3.0f * i);
+        }
+    }
+
+    SECTION("reduce")
+    {
+        const TestType& const_table = table;
+
+        CHECK(const_table.template reduce<&particle::id>(0) == 1233 * 617);
+        CHECK(const_table.template reduce<&particle::id>(
+                  5, [](int lhs, int rhs) { return std::max(lhs, rhs); }) ==
+              1233);
+
+        // dot product of two columns
+        const double dot = const_table.template reduce<&particle::x,
+                                                       &particle::v>(
+            0.0, std::plus<>(), [](float x, float v) { return double(x * v); });
+        CHECK(dot == Approx(0.5 * 1233 * 617));
+    }
+}
+
+
+TEMPLATE_TEST_CASE("run column kernels in parallel",
+                   "[soa]",
+                   particle_table,
+                   particle_arena,
+                   particle_blocks)
+{
+    TestType table;
+    // several parallel chunks, the last one partial
+    const int count = 3 * useful::soa_detail::parallel_chunk + 123;
+    for(int i = 0; i < count; ++i)
+    {
+        table.push_back(particle{i * 1.0f, 0.5f, i});
+    }
+
+    SECTION("every element is updated once")
+    {
+        std::atomic<std::size_t> total(0);
+        table.template parallel_for_each_columns<&particle::x, &particle::v>(
+            [&](std::size_t n, float* x, const float* v) {
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    x[i] += v[i];
+                }
+                total += n;
+            },
+            4);
+
+        CHECK(total == std::size_t(count));
+        for(int i = 0; i < count; ++i)
+        {
+            CHECK(table[i].template get<0>() == i + 0.5f);
+        }
+    }
+
+    SECTION("on a const container")
+    {
+        const TestType& const_table = table;
+
+        std::atomic<long> sum(0);
+        const_table.template parallel_for_each_columns<&particle::id>(
+            [&](std::size_t n, const int* id) {
+                long partial = 0;
+                for(std::size_t i = 0; i < n; ++i)
+                {
+                    partial += id[i];
+                }
+                sum += partial;
+            });
+
+        CHECK(sum == long(count - 1) * count / 2);
+    }
+}
@@ -0,0 +1,200 @@
+#include <array>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+#include <space_filling_curve.hpp>
+
+
+namespace
+{
+template <std::size_t Dims>
+std::uint64_t
+naive_interleave(const std::array<std::uint32_t, Dims>& cells)
+{
+    std::uint64_t key = 0u;
+    for(std::size_t bit = 0; bit * Dims < 64; ++bit)
+    {
+        for(std::size_t dim = 0; dim < Dims && bit * Dims + dim < 64; ++dim)
+        {
+            key |= std::uint64_t((cells[dim] >> bit) & 1u)
+                   << (bit * Dims + dim);
+        }
+    }
+
+    return key;
+}
+
+std::uint32_t
+distance(std::uint32_t lhs, std::uint32_t rhs)
+{
+    return lhs < rhs ? rhs - lhs : lhs - rhs;
+}
+} // namespace
+
+using namespace useful::multidim;
+
+
+TEST_CASE("encode cells along curves", "[multidim::space_filling_curve]")
+{
+    std::mt19937 gen(3);
+
+    SECTION("morton keys interleave the bits of all dimensions")
+    {
+        std::uniform_int_distribution<std::uint32_t> dist2(0u, 0xffffffffu);
+        std::uniform_int_distribution<std::uint32_t> dist3(0u, 0x1fffffu);
+        std::uniform_int_distribution<std::uint32_t> dist5(0u, 0xfffu);
+
+        for(int i = 0; i < 1000; ++i)
+        {
+            const std::array<std::uint32_t, 2> c2{dist2(gen), dist2(gen)};
+            CHECK(morton_encode(c2) == naive_interleave(c2));
+
+            const std::array<std::uint32_t, 3> c3{
+                dist3(gen), dist3(gen), dist3(gen)};
+            CHECK(morton_encode(c3) == naive_interleave(c3));
+
+            const std::array<std::uint32_t, 5> c5{
+                dist5(gen), dist5(gen), dist5(gen), dist5(gen), dist5(gen)};
+            CHECK(morton_encode(c5) == naive_interleave(c5));
+        }
+    }
+
+    SECTION("hilbert keys visit every cell once, stepping to a neighbour")
+    {
+        const std::size_t bits = 4;
+        std::vector<std::array<std::uint32_t, 2>> by_key(256);
+        std::vector<bool> seen(256, false);
+
+        for(std::uint32_t x = 0; x < 16u; ++x)
+        {
+            for(std::uint32_t y = 0; y < 16u; ++y)
+            {
+                const std::uint64_t key =
+                    hilbert_encode(std::array<std::uint32_t, 2>{x, y}, bits);
+                REQUIRE(key < 256u);
+                CHECK_FALSE(seen[key]);
+                seen[key] = true;
+                by_key[key] = {x, y};
+            }
+        }
+
+        for(std::size_t key = 1; key < by_key.size(); ++key)
+        {
+            CHECK(distance(by_key[key - 1][0], by_key[key][0]) +
+                      distance(by_key[key - 1][1], by_key[key][1]) ==
+                  1u);
+        }
+    }
+
+    SECTION("hilbert keys in three dimensions step to a neighbour")
+    {
+        const std::size_t bits = 3;
+        std::vector<std::array<std::uint32_t, 3>> by_key(512);
+
+        for(std::uint32_t x = 0; x < 8u; ++x)
+        {
+            for(std::uint32_t y = 0; y < 8u; ++y)
+            {
+                for(std::uint32_t z = 0; z < 8u; ++z)
+                {
+                    const std::array<std::uint32_t, 3> cell{x, y, z};
+                    by_key[hilbert_encode(cell, bits)] = cell;
+                }
+            }
+        }
+
+        for(std::size_t key = 1; key < by_key.size(); ++key)
+        {
+            std::uint32_t steps = 0u;
+            for(std::size_t dim = 0; dim < 3; ++dim)
+            {
+                steps += distance(by_key[key - 1][dim], by_key[key][dim]);
+            }
+            CHECK(steps == 1u);
+        }
+    }
+}
+
+
+TEST_CASE("sort points along curves", "[multidim::space_filling_curve]")
+{
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+
+    std::vector<std::array<float, 3>> points(5000);
+    for(auto& pt : points)
+    {
+        pt = {dist(gen), dist(gen), dist(gen)};
+    }
+
+    const curve_grid<std::array<float, 3>> grid(points.begin(), points.end());
+
+    SECTION("points outside the bounds are clamped")
+    {
+        const auto low = grid.cell({-100.0f, -100.0f, -100.0f});
+        const auto high = grid.cell({100.0f, 100.0f, 100.0f});
+
+        for(std::size_t dim = 0; dim < 3; ++dim)
+        {
+            CHECK(low[dim] == 0u);
+            CHECK(high[dim] == (1u << grid.bits) - 1u);
+        }
+    }
+
+    SECTION("radix sort is stable and orders by key")
+    {
+        std::uniform_int_distribution<std::uint64_t> keys_dist(0u, 50u);
+        std::vector<std::uint64_t> keys(points.size());
+        std::vector<std::size_t> values(points.size());
+        for(std::size_t i = 0; i < keys.size(); ++i)
+        {
+            keys[i] = keys_dist(gen) << 40u;
+            values[i] = i;
+        }
+
+        const auto original = keys;
+        radix_sort_by_key(values.begin(), values.end(), keys);
+
+        CHECK(std::is_sorted(keys.begin(), keys.end()));
+        for(std::size_t i = 0; i < values.size(); ++i)
+        {
+            CHECK(keys[i] == original[values[i]]);
+            if(i > 0 && keys[i - 1] == keys[i])
+            {
+                CHECK(values[i - 1] < values[i]);
+            }
+        }
+    }
+
+    SECTION("sorting orders points by curve key")
+    {
+        for(curve kind : {curve::morton, curve::hilbert})
+        {
+            const auto order = curve_order(points.begin(), points.end(), kind);
+
+            auto sorted = points;
+            sort_by_curve(sorted.begin(), sorted.end(), kind);
+
+            auto key = [&grid, kind](const std::array<float, 3>& pt) {
+                return kind == curve::morton ? grid.morton_key(pt)
+                                             : grid.hilbert_key(pt);
+            };
+
+            REQUIRE(order.size() == points.size());
+            for(std::size_t i = 0; i < sorted.size(); ++i)
+            {
+                CHECK(sorted[i] == points[order[i]]);
+                if(i > 0)
+                {
+                    CHECK(key(sorted[i - 1]) <= key(sorted[i]));
+                }
+            }
+
+            CHECK(std::is_permutation(
+                sorted.begin(), sorted.end(), points.begin()));
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iterator>
+
+#include <catch2/catch.hpp>
+#include <static_kdtree.hpp>
+
+
+namespace
+{
+struct space_point
+{
+    float x, y, z;
+};
+
+std::vector<space_point>
+random_space_points(std::size_t n, unsigned seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dist(-50.0f, 50.0f);
+
+    std::vector<space_point> out(n);
+    for(auto& pt : out)
+    {
+        pt = space_point{dist(gen), dist(gen), dist(gen)};
+    }
+
+    return out;
+}
+} // namespace
+
+using useful::multidim::static_kdtree;
+
+
+TEST_CASE("construct a static_kdtree", "[multidim::static_kdtree]")
+{
+    SECTION("empty")
+    {
+        static_kdtree<space_point> kdt;
+
+        CHECK(kdt.empty());
+        CHECK(kdt.nearest(space_point{0.0f, 0.0f, 0.0f}) == kdt.cend());
+    }
+
+    SECTION("stores nothing but the points")
+    {
+        const auto points = random_space_points(1000, 1);
+        static_kdtree<space_point> kdt(points.begin(), points.end());
+
+        CHECK(kdt.size() == points.size());
+        CHECK(sizeof(static_kdtree<space_point>) ==
+              sizeof(std::vector<space_point>));
+    }
+}
+
+
+TEST_CASE("query a static_kdtree", "[multidim::static_kdtree]")
+{
+    for(std::size_t n : {1ul, 2ul, 3ul, 10ul, 1023ul, 1024ul, 1500ul})
+    {
+        const auto points = random_space_points(n, unsigned(n));
+        static_kdtree<space_point> kdt(points.begin(), points.end());
+
+        for(const auto& target : random_space_points(20, 99))
+        {
+            std::vector<float> expected;
+            for(const auto& pt : points)
+            {
+                expected.push_back(
+                    useful::multidim::squared_distance(pt, target));
+            }
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<space_point> result;
+            kdt.k_nearest(target, 4, std::back_inserter(result));
+
+            REQUIRE(result.size() == std::min<std::size_t>(4, n));
+            for(std::size_t i = 0; i < result.size(); ++i)
+            {
+                CHECK(useful::multidim::squared_distance(result[i], target) ==
+                      Approx(expected[i]));
+            }
+
+            const float r = 20.0f * 20.0f;
+            std::vector<space_point> in_radius;
+            kdt.radius_query(target, r, std::back_inserter(in_radius));
+
+            CHECK(in_radius.size() ==
+                  static_cast<std::size_t>(std::count_if(
+                      expected.begin(), expected.end(), [r](float d) {
+                          return d <= r;
+                      })));
+        }
+
+        std::vector<space_point> in_box;
+        kdt.range_query(space_point{-10.0f, -10.0f, -10.0f},
+                        space_point{10.0f, 20.0f, 30.0f},
+                        std::back_inserter(in_box));
+
+        CHECK(in_box.size() ==
+              static_cast<std::size_t>(
+                  std::count_if(points.begin(), points.end(), [](auto& pt) {
+                      return pt.x >= -10.0f && pt.x <= 10.0f &&
+                             pt.y >= -10.0f && pt.y <= 20.0f &&
+                             pt.z >= -10.0f && pt.z <= 30.0f;
+                  })));
+    }
+}